@@ -1,7 +1,46 @@
 #include "bench.hpp"
 
+#include <new>
+
 #include "common.hpp"
 
+// Replace the global allocation functions so benchmarks can check how many
+// allocations an operation makes
+static thread_local size_t allocation_count = 0;
+
+size_t bench_allocation_count() {
+    return allocation_count;
+}
+
+void *operator new(size_t size) {
+    ++allocation_count;
+    void *res = ::malloc(size == 0 ? 1 : size);
+    if (res == nullptr) {
+        throw std::bad_alloc();
+    }
+    return res;
+}
+
+void *operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    ::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    ::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    ::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    ::free(ptr);
+}
+
 void timespec_subtract(struct timespec *x,
                        struct timespec *y,
                        struct timespec *result) {
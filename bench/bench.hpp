@@ -2,6 +2,7 @@
 #define BENCH_HPP_
 
 #include <time.h>
+#include <cstddef>
 #include <string>
 
 class bench_timer_t {
@@ -14,4 +15,7 @@ private:
     struct timespec m_start_time;
 };
 
+// Number of global operator new calls made by the calling thread so far
+size_t bench_allocation_count();
+
 #endif // BENCH_HPP_
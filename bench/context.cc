@@ -0,0 +1,52 @@
+#include "catch.hpp"
+
+#include <memory>
+
+#include "coro/context.hpp"
+
+#include "bench.hpp"
+
+using namespace indecorous;
+
+const size_t swap_reps = 1000000;
+const size_t swap_stack_size = 64 * 1024;
+
+// Bounces between the bench thread's context and a single context running on
+// its own stack, without any dispatcher or run queue overhead
+template <typename context_type>
+struct swap_pair_t {
+    swap_pair_t() : outer(), inner(), count(0) { }
+
+    static void bounce(void *p) {
+        swap_pair_t *self = reinterpret_cast<swap_pair_t *>(p);
+        while (true) {
+            ++self->count;
+            self->inner.swap(&self->outer);
+        }
+    }
+
+    void run(const char *name) {
+        std::unique_ptr<char[]> stack(new char[swap_stack_size]);
+        inner.make(stack.get(), swap_stack_size, &swap_pair_t::bounce, this);
+
+        {
+            // Each iteration is two swaps
+            bench_timer_t timer(name, swap_reps * 2);
+            for (size_t i = 0; i < swap_reps; ++i) {
+                outer.swap(&inner);
+            }
+        }
+        CHECK(count == swap_reps);
+    }
+
+    context_type outer;
+    context_type inner;
+    size_t count;
+};
+
+TEST_CASE("context/swap", "[context][swap]") {
+    swap_pair_t<ucontext_context_t>().run("context/swap ucontext");
+#if INDECOROUS_HAS_ASM_CONTEXT
+    swap_pair_t<asm_context_t>().run("context/swap asm");
+#endif
+}
@@ -245,6 +245,8 @@ struct bench_t {
 
     DECLARE_STATIC_RPC(spawn_now)() -> void;
     DECLARE_STATIC_RPC(spawn_deferred)() -> void;
+    DECLARE_STATIC_RPC(spawn_detached)() -> void;
+    DECLARE_STATIC_RPC(spawn_many)() -> void;
 };
 
 IMPL_STATIC_RPC(bench_t::spawn_now)() -> void {
@@ -259,6 +261,58 @@ IMPL_STATIC_RPC(bench_t::spawn_deferred)() -> void {
     run_deferred(450000, std::make_integer_sequence<int, 10>{});
 }
 
+IMPL_STATIC_RPC(bench_t::spawn_detached)() -> void {
+    // Let each batch finish before spawning more so that the coro_cache_t never runs dry
+    const size_t batch_size = 16;
+    int res = 0;
+    auto fn = [&res] (int a, int b) { res += a + b; };
+
+    // Warm up the coro_cache_t
+    for (size_t i = 0; i < batch_size; ++i) {
+        coro_t::spawn_detached(fn, 1, 2);
+    }
+    coro_t::yield();
+
+    // Only count allocations made by the spawn itself, not by the event loop
+    size_t spawn_allocations = 0;
+    bench_timer_t timer("coro/spawn_detached lambda", reps);
+    for (size_t i = 0; i < reps; ++i) {
+        size_t initial_allocations = bench_allocation_count();
+        coro_t::spawn_detached(fn, 1, 2);
+        spawn_allocations += bench_allocation_count() - initial_allocations;
+        if (i % batch_size == batch_size - 1) {
+            coro_t::yield();
+        }
+    }
+    coro_t::yield();
+
+    CHECK(spawn_allocations == 0);
+    CHECK(res == static_cast<int>((reps + batch_size) * 3));
+}
+
+IMPL_STATIC_RPC(bench_t::spawn_many)() -> void {
+    // Batches are waited on before spawning more so that the coro_cache_t never runs dry
+    const size_t batch_size = 16;
+    int res = 0;
+    auto fn = [&res] (size_t) { res += 3; };
+
+    // Warm up the coro_cache_t
+    coro_t::spawn_many(0, batch_size, fn).wait();
+
+    size_t spawn_allocations = 0;
+    bench_timer_t timer("coro/spawn_many lambda", reps);
+    for (size_t i = 0; i < reps; i += batch_size) {
+        size_t initial_allocations = bench_allocation_count();
+        coro_batch_t batch = coro_t::spawn_many(0, batch_size, fn);
+        spawn_allocations += bench_allocation_count() - initial_allocations;
+        batch.wait();
+    }
+
+    // Just the shared state of each batch
+    CHECK(spawn_allocations == (reps + batch_size - 1) / batch_size);
+    CHECK(res == static_cast<int>((reps + batch_size - 1) / batch_size * batch_size * 3 + batch_size * 3));
+}
+
 TEST_CASE("coro/spawn", "[coro][spawn]") {
     scheduler_t sched_now(1, shutdown_policy_t::Eager);
     sched_now.broadcast_local<bench_t::spawn_now>();
@@ -267,4 +321,12 @@ TEST_CASE("coro/spawn", "[coro][spawn]") {
     scheduler_t sched_deferred(1, shutdown_policy_t::Eager);
     sched_deferred.broadcast_local<bench_t::spawn_deferred>();
     sched_deferred.run();
+
+    scheduler_t sched_detached(1, shutdown_policy_t::Eager);
+    sched_detached.broadcast_local<bench_t::spawn_detached>();
+    sched_detached.run();
+
+    scheduler_t sched_many(1, shutdown_policy_t::Eager);
+    sched_many.broadcast_local<bench_t::spawn_many>();
+    sched_many.run();
 }
@@ -0,0 +1,64 @@
+#include "catch.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "containers/file.hpp"
+#include "coro/sched.hpp"
+#include "rpc/handler.hpp"
+#include "sync/file_wait.hpp"
+
+#include "bench.hpp"
+
+using namespace indecorous;
+
+const size_t file_wait_reps = 100000;
+
+struct events_bench_t {
+    DECLARE_STATIC_RPC(file_wait)(bool registered) -> void;
+};
+
+// Each wait goes through the thread's event loop, which should not allocate
+IMPL_STATIC_RPC(events_bench_t::file_wait)(bool registered) -> void {
+    int fds[2];
+    GUARANTEE_ERR(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0);
+    scoped_fd_t read_end(fds[0]);
+    scoped_fd_t write_end(fds[1]);
+    std::unique_ptr<file_registration_t> registration;
+    if (registered) {
+        registration.reset(new file_registration_t(read_end.get()));
+    }
+
+    file_wait_t in = file_wait_t::in(read_end.get());
+    auto ping = [&] {
+        char c = 0;
+        GUARANTEE_ERR(::write(write_end.get(), &c, 1) == 1);
+        in.wait();
+        GUARANTEE_ERR(::read(read_end.get(), &c, 1) == 1);
+    };
+
+    // The first waits size the event loop's buffers
+    ping();
+
+    size_t allocations = 0;
+    {
+        bench_timer_t timer(registered ? "events/file_wait registered" : "events/file_wait",
+                            file_wait_reps);
+        for (size_t i = 0; i < file_wait_reps; ++i) {
+            size_t initial_allocations = bench_allocation_count();
+            ping();
+            allocations += bench_allocation_count() - initial_allocations;
+        }
+    }
+    CHECK(allocations == 0);
+}
+
+TEST_CASE("events/file_wait", "[events][file_wait]") {
+    scheduler_t sched(1, shutdown_policy_t::Eager);
+    sched.broadcast_local<events_bench_t::file_wait>(false);
+    sched.run();
+    sched.broadcast_local<events_bench_t::file_wait>(true);
+    sched.run();
+}
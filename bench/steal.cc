@@ -0,0 +1,98 @@
+#include "catch.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "coro/sched.hpp"
+#include "coro/thread.hpp"
+#include "rpc/handler.hpp"
+#include "rpc/hub.hpp"
+#include "rpc/target.hpp"
+
+#include "bench.hpp"
+
+using namespace indecorous;
+
+const size_t skewed_threads = 4;
+const size_t skewed_reps = 2000;
+const uint64_t skewed_work_ns = 20000;
+
+uint64_t skewed_now_ns() {
+    struct timespec now;
+    GUARANTEE(clock_gettime(CLOCK_MONOTONIC, &now) == 0);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Time from each task being sent until it finished
+std::mutex skewed_latency_mutex;
+std::vector<uint64_t> skewed_latencies;
+
+void skewed_task(uint64_t sent_ns) {
+    uint64_t start_ns = skewed_now_ns();
+    while (skewed_now_ns() - start_ns < skewed_work_ns) { }
+
+    uint64_t latency = skewed_now_ns() - sent_ns;
+    std::lock_guard<std::mutex> lock(skewed_latency_mutex);
+    skewed_latencies.push_back(latency);
+}
+
+struct steal_bench_t {
+    DECLARE_STATIC_RPC(pinned)(uint64_t sent_ns) -> void;
+    DECLARE_STEALABLE_STATIC_RPC(stealable)(uint64_t sent_ns) -> void;
+    DECLARE_STATIC_RPC(skewed_pinned)() -> void;
+    DECLARE_STATIC_RPC(skewed_stealable)() -> void;
+};
+
+IMPL_STATIC_RPC(steal_bench_t::pinned)(uint64_t sent_ns) -> void {
+    skewed_task(sent_ns);
+}
+
+IMPL_STATIC_RPC(steal_bench_t::stealable)(uint64_t sent_ns) -> void {
+    skewed_task(sent_ns);
+}
+
+// All of the load is sent to the first thread, the rest start out idle
+template <typename RPC>
+void send_skewed() {
+    thread_t *self = thread_t::self();
+    if (self->target() == self->hub()->local_targets()[0]) {
+        for (size_t i = 0; i < skewed_reps; ++i) {
+            self->target()->call_noreply<RPC>(skewed_now_ns());
+        }
+    }
+}
+
+IMPL_STATIC_RPC(steal_bench_t::skewed_pinned)() -> void {
+    send_skewed<steal_bench_t::pinned>();
+}
+
+IMPL_STATIC_RPC(steal_bench_t::skewed_stealable)() -> void {
+    send_skewed<steal_bench_t::stealable>();
+}
+
+template <typename RPC>
+void run_skewed(const char *name) {
+    skewed_latencies.clear();
+    scheduler_t sched(skewed_threads, shutdown_policy_t::Eager);
+    {
+        bench_timer_t timer(name, skewed_reps);
+        sched.broadcast_local<RPC>();
+        sched.run();
+    }
+
+    REQUIRE(skewed_latencies.size() == skewed_reps);
+    std::sort(skewed_latencies.begin(), skewed_latencies.end());
+    auto percentile_ms = [] (size_t p) {
+        return static_cast<double>(skewed_latencies[(skewed_reps - 1) * p / 100]) / 1000000.0;
+    };
+    logInfo("%s | latency p50 %.3f ms | p99 %.3f ms | max %.3f ms",
+            name, percentile_ms(50), percentile_ms(99), percentile_ms(100));
+}
+
+TEST_CASE("steal/skewed", "[steal]") {
+    run_skewed<steal_bench_t::skewed_pinned>("steal/skewed stealing off");
+    run_skewed<steal_bench_t::skewed_stealable>("steal/skewed stealing on");
+}
@@ -0,0 +1,79 @@
+#include "catch.hpp"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "coro/timer_wheel.hpp"
+#include "sync/timer.hpp"
+
+#include "bench.hpp"
+
+using namespace indecorous;
+
+const size_t wheel_timers = 1000000;
+const int64_t wheel_max_delta_ms = 60 * 1000;
+
+class bench_callback_t final : public timer_callback_t {
+public:
+    explicit bench_callback_t(int64_t delta_ms) {
+        m_timeout = absolute_time_t(delta_ms);
+    }
+
+    void timer_callback(wait_result_t) override final { }
+};
+
+TEST_CASE("timer/wheel", "[timer][wheel]") {
+    std::mt19937 gen(1234);
+    std::uniform_int_distribution<int64_t> dist(0, wheel_max_delta_ms);
+
+    std::vector<std::unique_ptr<bench_callback_t> > timers;
+    timers.reserve(wheel_timers);
+    for (size_t i = 0; i < wheel_timers; ++i) {
+        timers.emplace_back(new bench_callback_t(dist(gen)));
+    }
+
+    timer_wheel_t wheel;
+    uint64_t start_ms = timer_wheel_t::now_ms();
+    {
+        bench_timer_t timer("timer/wheel add", wheel_timers);
+        for (auto &t : timers) {
+            wheel.add(t.get());
+        }
+    }
+
+    // Restarting a timer is a remove and an add, with every other timer running
+    {
+        bench_timer_t timer("timer/wheel restart", wheel_timers);
+        for (auto &t : timers) {
+            wheel.remove(t.get());
+            wheel.add(t.get());
+        }
+    }
+
+    // One tick at a time, as an idle thread would see them
+    size_t expired = 0;
+    {
+        bench_timer_t timer("timer/wheel expire", wheel_timers);
+        for (uint64_t now = start_ms; now <= start_ms + wheel_max_delta_ms + 1; ++now) {
+            wheel.advance(now);
+            while (timer_callback_t *cb = wheel.pop_expired()) {
+                cb->timer_callback(wait_result_t::Success);
+                ++expired;
+            }
+        }
+    }
+    CHECK(expired == wheel_timers);
+    CHECK(wheel.size() == 0u);
+
+    for (auto &t : timers) {
+        wheel.add(t.get());
+    }
+    {
+        bench_timer_t timer("timer/wheel remove", wheel_timers);
+        for (auto &t : timers) {
+            wheel.remove(t.get());
+        }
+    }
+    CHECK(wheel.size() == 0u);
+}
@@ -17,6 +17,12 @@
 
 #define UNUSED __attribute__((unused))
 
+// Per-coroutine time accounting is only compiled in when this is set, e.g. with
+// `make CORO_STATS=1`.  It costs two cycle_clock_t reads per swap.
+#ifndef INDECOROUS_CORO_STATS
+    #define INDECOROUS_CORO_STATS 0
+#endif
+
 #ifdef NDEBUG
     #define DEBUG_ONLY(...)
     #define DEBUG_VAR UNUSED
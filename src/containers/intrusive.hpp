@@ -123,6 +123,25 @@ public:
         std::swap(m_size, other->m_size);
     }
 
+    // Moves all of `other` to the back of this list in constant time
+    void splice_back(intrusive_list_t<T> *other) {
+        if (other->m_size == 0) {
+            return;
+        }
+        intrusive_node_t<T> *first = other->next_node();
+        intrusive_node_t<T> *last = other->prev_node();
+        intrusive_node_t<T> *tail = this->prev_node();
+        tail->set_next_node(first);
+        first->set_prev_node(tail);
+        last->set_next_node(this);
+        this->set_prev_node(last);
+        m_size += other->m_size;
+
+        other->set_next_node(other);
+        other->set_prev_node(other);
+        other->m_size = 0;
+    }
+
     size_t size() const {
         return m_size;
     }
@@ -281,6 +300,12 @@ public:
         return nullptr;
     }
 
+    // Safe to call from any thread, but a concurrent push may or may not be seen.
+    // A pushed item may also be seen here shortly before pop() can return it.
+    bool empty() const {
+        return m_back.load() == reinterpret_cast<intptr_t>(this);
+    }
+
     // This may not be accurate if called when other threads could be writing to the queue
     size_t size() const {
         size_t res = 0;
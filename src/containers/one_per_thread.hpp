@@ -15,7 +15,8 @@ class one_per_thread_t {
 public:
     one_per_thread_t(T initial_value) :
             m_thread_data() {
-        for (auto &&t : thread_t::self()->hub()->local_targets()) {
+        // Parked threads may be activated later, and this must not be resized then
+        for (auto &&t : thread_t::self()->hub()->all_local_targets()) {
             m_thread_data[t->id()] = initial_value;
         }
     }
@@ -25,7 +26,7 @@ public:
     }
 
     const T &get() const {
-        return m_thread_data[thread_t::self()->target()->id()];
+        return m_thread_data.at(thread_t::self()->target()->id());
     }
 
 private:
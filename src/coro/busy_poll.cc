@@ -0,0 +1,59 @@
+#include "coro/busy_poll.hpp"
+
+#include <algorithm>
+
+#include "coro/cycle_clock.hpp"
+
+namespace indecorous {
+
+std::atomic<uint64_t> busy_poll_t::s_max_spin_ns(0);
+
+const uint64_t busy_poll_t::s_min_spin_ns = 2 * 1000;
+
+busy_poll_t::busy_poll_t() :
+        m_budget_ns(0),
+        m_hits(0),
+        m_blocks(0),
+        m_spin_ticks(0) { }
+
+uint64_t busy_poll_t::budget() const {
+    uint64_t max_ns = s_max_spin_ns.load(std::memory_order_relaxed);
+    uint64_t budget_ns = std::min(m_budget_ns.load(std::memory_order_relaxed), max_ns);
+    return (budget_ns == 0) ? 0 : cycle_clock_t::from_ns(budget_ns);
+}
+
+void busy_poll_t::note_hit(uint64_t spun_ticks) {
+    m_hits.store(m_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_spin_ticks.store(m_spin_ticks.load(std::memory_order_relaxed) + spun_ticks,
+                       std::memory_order_relaxed);
+}
+
+void busy_poll_t::note_block(uint64_t spun_ticks, uint64_t blocked_ticks) {
+    m_blocks.store(m_blocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_spin_ticks.store(m_spin_ticks.load(std::memory_order_relaxed) + spun_ticks,
+                       std::memory_order_relaxed);
+
+    uint64_t max_ns = s_max_spin_ns.load(std::memory_order_relaxed);
+    uint64_t budget_ns = std::min(m_budget_ns.load(std::memory_order_relaxed), max_ns);
+    if (cycle_clock_t::to_ns(blocked_ticks) <= max_ns) {
+        // A longer spin would have caught this
+        budget_ns = std::min(std::max(budget_ns * 2, s_min_spin_ns), max_ns);
+    } else {
+        budget_ns /= 2;
+        if (budget_ns < s_min_spin_ns) {
+            budget_ns = 0;
+        }
+    }
+    m_budget_ns.store(budget_ns, std::memory_order_relaxed);
+}
+
+busy_poll_t::stats_t busy_poll_t::stats() const {
+    stats_t res;
+    res.hits = m_hits.load(std::memory_order_relaxed);
+    res.blocks = m_blocks.load(std::memory_order_relaxed);
+    res.spin_ns = cycle_clock_t::to_ns(m_spin_ticks.load(std::memory_order_relaxed));
+    res.budget_ns = m_budget_ns.load(std::memory_order_relaxed);
+    return res;
+}
+
+} // namespace indecorous
@@ -0,0 +1,59 @@
+#ifndef CORO_BUSY_POLL_HPP_
+#define CORO_BUSY_POLL_HPP_
+
+#include <atomic>
+#include <cstdint>
+
+#include "common.hpp"
+
+namespace indecorous {
+
+// How long an idle coro thread spins before blocking in epoll.  Waking a thread
+// blocked in epoll_wait costs tens of microseconds on top of the eventfd write,
+// so while work tends to arrive soon after the thread goes idle, it keeps
+// checking its queue and polling for events without blocking instead.  The
+// budget adapts to recent arrivals, like KVM's halt polling: it grows while the
+// thread is woken within s_max_spin_ns of blocking, and shrinks while it stays
+// blocked for longer, so a thread that stays idle spins less and less.
+class busy_poll_t {
+public:
+    busy_poll_t();
+
+    // How long the next spin may last, in cycle_clock_t ticks
+    uint64_t budget() const;
+
+    // Called after a spin that found something to run
+    void note_hit(uint64_t spun_ticks);
+
+    // Called after a spin that found nothing, once the blocking poll returns
+    void note_block(uint64_t spun_ticks, uint64_t blocked_ticks);
+
+    // Counters for this thread, safe to read from other threads
+    struct stats_t {
+        uint64_t hits;
+        uint64_t blocks;
+        uint64_t spin_ns;
+        uint64_t budget_ns;
+    };
+    stats_t stats() const;
+
+    // The longest a thread may spin for at once, read at every spin, 0 disables
+    // spinning
+    static std::atomic<uint64_t> s_max_spin_ns;
+
+    // The budget never goes below this once it is nonzero
+    static const uint64_t s_min_spin_ns;
+
+private:
+    // Only written by the owning thread
+    std::atomic<uint64_t> m_budget_ns;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_blocks;
+    std::atomic<uint64_t> m_spin_ticks;
+
+    DISABLE_COPYING(busy_poll_t);
+};
+
+} // namespace indecorous
+
+#endif // CORO_BUSY_POLL_HPP_
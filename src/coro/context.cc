@@ -0,0 +1,173 @@
+#include "coro/context.hpp"
+
+#include <cstdint>
+
+namespace indecorous {
+
+ucontext_context_t::ucontext_context_t() :
+        m_context(),
+        m_fn(nullptr),
+        m_arg(nullptr) { }
+
+void ucontext_context_t::make(char *stack, size_t stack_size, context_fn_t fn, void *arg) {
+    m_fn = fn;
+    m_arg = arg;
+
+    GUARANTEE_ERR(getcontext(&m_context) == 0);
+    m_context.uc_stack.ss_sp = stack;
+    m_context.uc_stack.ss_size = stack_size;
+    m_context.uc_link = nullptr;
+
+    uintptr_t self = reinterpret_cast<uintptr_t>(this);
+    makecontext(&m_context, (void (*)())&ucontext_context_t::trampoline, 2,
+                static_cast<unsigned int>(self >> 32),
+                static_cast<unsigned int>(self & 0xFFFFFFFF));
+}
+
+void ucontext_context_t::trampoline(unsigned int high, unsigned int low) {
+    uintptr_t self_int = (static_cast<uintptr_t>(high) << 32) | static_cast<uintptr_t>(low);
+    ucontext_context_t *self = reinterpret_cast<ucontext_context_t *>(self_int);
+    self->m_fn(self->m_arg);
+    ::abort();
+}
+
+} // namespace indecorous
+
+#if INDECOROUS_HAS_ASM_CONTEXT
+
+extern "C" void indecorous_context_entry();
+
+#if defined(__x86_64__)
+
+// Stack layout of a suspended context, from the saved stack pointer upwards:
+//   mxcsr and x87 control word, r15, r14, r13, r12, rbx, rbp, return address
+asm(".pushsection .text.indecorous_context,\"ax\",%progbits\n"
+    ".globl indecorous_context_swap\n"
+    ".hidden indecorous_context_swap\n"
+    ".type indecorous_context_swap,%function\n"
+    "indecorous_context_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size indecorous_context_swap,.-indecorous_context_swap\n"
+    "\n"
+    // First instruction run by a new context: r12 holds the function, r13 its argument
+    ".globl indecorous_context_entry\n"
+    ".hidden indecorous_context_entry\n"
+    ".type indecorous_context_entry,%function\n"
+    "indecorous_context_entry:\n"
+    "    movq %r13, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+    ".size indecorous_context_entry,.-indecorous_context_entry\n"
+    ".popsection\n");
+
+namespace indecorous {
+
+asm_context_t::asm_context_t() : m_sp(nullptr) { }
+
+void asm_context_t::make(char *stack, size_t stack_size, context_fn_t fn, void *arg) {
+    uintptr_t top = reinterpret_cast<uintptr_t>(stack + stack_size) & ~static_cast<uintptr_t>(15);
+    uint64_t *frame = reinterpret_cast<uint64_t *>(top) - 8;
+
+    frame[0] = 0x037F00001F80; // Default x87 control word and mxcsr
+    frame[1] = 0; // r15
+    frame[2] = 0; // r14
+    frame[3] = reinterpret_cast<uint64_t>(arg); // r13
+    frame[4] = reinterpret_cast<uint64_t>(fn); // r12
+    frame[5] = 0; // rbx
+    frame[6] = 0; // rbp - terminates frame-pointer walks
+    frame[7] = reinterpret_cast<uint64_t>(&indecorous_context_entry);
+    m_sp = frame;
+}
+
+} // namespace indecorous
+
+#elif defined(__aarch64__)
+
+// Stack layout of a suspended context, from the saved stack pointer upwards:
+//   x19-x28, x29 (frame pointer), x30 (link register), d8-d15
+asm(".pushsection .text.indecorous_context,\"ax\",%progbits\n"
+    ".globl indecorous_context_swap\n"
+    ".hidden indecorous_context_swap\n"
+    ".type indecorous_context_swap,%function\n"
+    "indecorous_context_swap:\n"
+    "    sub sp, sp, #0xa0\n"
+    "    stp x19, x20, [sp, #0x00]\n"
+    "    stp x21, x22, [sp, #0x10]\n"
+    "    stp x23, x24, [sp, #0x20]\n"
+    "    stp x25, x26, [sp, #0x30]\n"
+    "    stp x27, x28, [sp, #0x40]\n"
+    "    stp x29, x30, [sp, #0x50]\n"
+    "    stp d8, d9, [sp, #0x60]\n"
+    "    stp d10, d11, [sp, #0x70]\n"
+    "    stp d12, d13, [sp, #0x80]\n"
+    "    stp d14, d15, [sp, #0x90]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0x00]\n"
+    "    ldp x21, x22, [sp, #0x10]\n"
+    "    ldp x23, x24, [sp, #0x20]\n"
+    "    ldp x25, x26, [sp, #0x30]\n"
+    "    ldp x27, x28, [sp, #0x40]\n"
+    "    ldp x29, x30, [sp, #0x50]\n"
+    "    ldp d8, d9, [sp, #0x60]\n"
+    "    ldp d10, d11, [sp, #0x70]\n"
+    "    ldp d12, d13, [sp, #0x80]\n"
+    "    ldp d14, d15, [sp, #0x90]\n"
+    "    add sp, sp, #0xa0\n"
+    "    ret\n"
+    ".size indecorous_context_swap,.-indecorous_context_swap\n"
+    "\n"
+    // First instruction run by a new context: x19 holds the function, x20 its argument
+    ".globl indecorous_context_entry\n"
+    ".hidden indecorous_context_entry\n"
+    ".type indecorous_context_entry,%function\n"
+    "indecorous_context_entry:\n"
+    "    mov x0, x20\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size indecorous_context_entry,.-indecorous_context_entry\n"
+    ".popsection\n");
+
+namespace indecorous {
+
+asm_context_t::asm_context_t() : m_sp(nullptr) { }
+
+void asm_context_t::make(char *stack, size_t stack_size, context_fn_t fn, void *arg) {
+    uintptr_t top = reinterpret_cast<uintptr_t>(stack + stack_size) & ~static_cast<uintptr_t>(15);
+    uint64_t *frame = reinterpret_cast<uint64_t *>(top) - 20;
+
+    for (size_t i = 0; i < 20; ++i) {
+        frame[i] = 0;
+    }
+    frame[0] = reinterpret_cast<uint64_t>(fn); // x19
+    frame[1] = reinterpret_cast<uint64_t>(arg); // x20
+    frame[11] = reinterpret_cast<uint64_t>(&indecorous_context_entry); // x30
+    m_sp = frame;
+}
+
+} // namespace indecorous
+
+#endif
+
+#endif // INDECOROUS_HAS_ASM_CONTEXT
@@ -0,0 +1,85 @@
+#ifndef CORO_CONTEXT_HPP_
+#define CORO_CONTEXT_HPP_
+
+#include <ucontext.h>
+
+#include <cstddef>
+
+#include "common.hpp"
+
+// Context-switching backends used by coro_t and dispatcher_t.  Each backend
+// exposes the same interface:
+//   make(stack, stack_size, fn, arg) - prepare the context to call `fn(arg)` on
+//                                      the given stack the first time it is
+//                                      swapped to.  `fn` must never return.
+//   swap(next)                       - save the running execution into `this`
+//                                      and resume `next`.
+// A default-constructed context may be used as the target of a `swap` to save
+// the current (e.g. the thread's main) execution.
+//
+// The assembly backend only saves callee-saved registers and does not touch
+// the signal mask, which is fine because coro threads block signals at
+// creation (see scheduler_t::construct_internal).  Define
+// INDECOROUS_USE_UCONTEXT to force the ucontext fallback.
+
+#if !defined(INDECOROUS_USE_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+    #define INDECOROUS_HAS_ASM_CONTEXT 1
+#else
+    #define INDECOROUS_HAS_ASM_CONTEXT 0
+#endif
+
+#if INDECOROUS_HAS_ASM_CONTEXT
+extern "C" void indecorous_context_swap(void **from_sp, void *to_sp);
+#endif
+
+namespace indecorous {
+
+typedef void (*context_fn_t)(void *);
+
+class ucontext_context_t {
+public:
+    ucontext_context_t();
+
+    void make(char *stack, size_t stack_size, context_fn_t fn, void *arg);
+
+    void swap(ucontext_context_t *next) {
+        GUARANTEE_ERR(swapcontext(&m_context, &next->m_context) == 0);
+    }
+
+private:
+    // makecontext only passes int arguments, so `this` is split in two
+    [[noreturn]] static void trampoline(unsigned int high, unsigned int low);
+
+    ucontext_t m_context;
+    context_fn_t m_fn;
+    void *m_arg;
+
+    DISABLE_COPYING(ucontext_context_t);
+};
+
+#if INDECOROUS_HAS_ASM_CONTEXT
+class asm_context_t {
+public:
+    asm_context_t();
+
+    void make(char *stack, size_t stack_size, context_fn_t fn, void *arg);
+
+    void swap(asm_context_t *next) {
+        indecorous_context_swap(&m_sp, next->m_sp);
+    }
+
+private:
+    // Saved stack pointer, the callee-saved registers are stored just above it
+    void *m_sp;
+
+    DISABLE_COPYING(asm_context_t);
+};
+
+typedef asm_context_t context_t;
+#else
+typedef ucontext_context_t context_t;
+#endif
+
+} // namespace indecorous
+
+#endif // CORO_CONTEXT_HPP_
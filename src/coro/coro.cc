@@ -1,12 +1,19 @@
 #include "coro/coro.hpp"
 
+#include <signal.h>
 #include <stdlib.h>
 #include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <valgrind/valgrind.h>
 
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "coro/cycle_clock.hpp"
 #include "coro/sched.hpp"
+#include "coro/stack_pool.hpp"
 #include "coro/thread.hpp"
 #include "errors.hpp"
 #include "rpc/target.hpp"
@@ -26,165 +33,742 @@ size_t round_size_up(size_t minimum_size, size_t multiple) {
     return minimum_size + multiple - remainder;
 }
 
-size_t dispatcher_t::s_max_swaps_per_loop = 100;
+std::atomic<uint64_t> dispatcher_t::s_target_loop_latency_ns(500 * 1000);
+
+const size_t run_queue_t::s_starvation_limit = 16;
 
 const size_t coro_t::s_page_size = ::sysconf(_SC_PAGESIZE);
-const size_t coro_t::s_stack_size = round_size_up(128 * 1024, coro_t::s_page_size);
+
+coro_t::stack_class_info_t coro_t::make_stack_class(size_t size, size_t watermark) {
+    // Make sure the watermark is always above the guard page
+    watermark = round_size_up(watermark, s_page_size);
+    return { std::max(round_size_up(size, s_page_size), watermark + s_page_size), watermark };
+}
+
+const coro_t::stack_class_info_t coro_t::s_stack_classes[num_stack_classes] = {
+    make_stack_class(64 * 1024, 8 * 1024), // Small
+    make_stack_class(1024 * 1024, 16 * 1024), // Medium
+    make_stack_class(8 * 1024 * 1024, 64 * 1024), // Large
+    make_stack_class(64 * 1024, 60 * 1024), // Compact - all committed but the bottom page
+};
+
+const uint64_t coro_t::s_compact_band = 0xB0BAC0DEB0BAC0DEULL;
+
+const size_t s_signal_stack_size = 64 * 1024;
+
+// Handles SIGSEGV for faults in the uncommitted part of the running coroutine's stack by
+// committing more of it.  This is installed while any dispatcher_t exists.  Any other fault
+// restores the previous handler so the fault happens again and is handled as it would
+// have been without us.  Note that debuggers will stop on these faults by default - use
+// `handle SIGSEGV nostop noprint` in gdb.
+class stack_fault_handler_t {
+public:
+    static void acquire() {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if (s_users++ == 0) {
+            struct sigaction sigact;
+            memset(&sigact, 0, sizeof(sigact));
+            sigact.sa_flags = SA_SIGINFO | SA_ONSTACK;
+            sigact.sa_sigaction = &stack_fault_handler_t::callback;
+            sigemptyset(&sigact.sa_mask);
+            GUARANTEE_ERR(sigaction(SIGSEGV, &sigact, &s_old_sigsegv) == 0);
+        }
+    }
+
+    static void release() {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        assert(s_users > 0);
+        if (--s_users == 0) {
+            GUARANTEE_ERR(sigaction(SIGSEGV, &s_old_sigsegv, nullptr) == 0);
+        }
+    }
+
+private:
+    static void callback(int signum, siginfo_t *info, void *context) {
+        thread_t *thread = thread_t::self();
+        dispatcher_t *dispatch = (thread == nullptr) ? nullptr : thread->dispatcher();
+        coro_t *coro = (dispatch == nullptr) ? nullptr : dispatch->m_running;
+        if (coro == nullptr || !coro->grow_stack(reinterpret_cast<char *>(info->si_addr))) {
+            chain(signum, info, context);
+        }
+    }
+
+    // Pass a fault that isn't ours on to whoever handled SIGSEGV before us
+    static void chain(int signum, siginfo_t *info, void *context) {
+        if ((s_old_sigsegv.sa_flags & SA_SIGINFO) != 0) {
+            s_old_sigsegv.sa_sigaction(signum, info, context);
+        } else if (s_old_sigsegv.sa_handler != SIG_DFL && s_old_sigsegv.sa_handler != SIG_IGN) {
+            s_old_sigsegv.sa_handler(signum);
+        } else {
+            // The fault happens again on return, and the default action is fatal
+            signal(SIGSEGV, SIG_DFL);
+        }
+    }
+
+    static std::mutex s_mutex;
+    static size_t s_users;
+    static struct sigaction s_old_sigsegv;
+};
+
+std::mutex stack_fault_handler_t::s_mutex;
+size_t stack_fault_handler_t::s_users = 0;
+struct sigaction stack_fault_handler_t::s_old_sigsegv;
 
 coro_cache_t::coro_cache_t(size_t max_cache_size,
                            dispatcher_t *dispatch) :
     m_max_cache_size(max_cache_size),
     m_dispatch(dispatch),
     m_extant(0),
-    m_cache() { }
+    m_cache(),
+    m_stack_bytes(0),
+    m_compact_stacks(coro_t::s_stack_classes[static_cast<size_t>(stack_class_t::Compact)].size)
+#if INDECOROUS_STACK_STATS
+    , m_stack_depths(),
+    m_stack_depths_by_site()
+#endif
+    { }
 
 coro_cache_t::~coro_cache_t() {
     assert(m_extant == 0);
-    m_cache.clear([] (auto c) { delete c; });
+    for (size_t i = 0; i < num_stack_classes; ++i) {
+        if (static_cast<stack_class_t>(i) == stack_class_t::Compact) {
+            m_cache[i].clear([] (auto c) { delete c; });
+        } else {
+            spill(static_cast<stack_class_t>(i), m_cache[i].size());
+        }
+    }
 }
 
-coro_t *coro_cache_t::get() {
+coro_t *coro_cache_t::get(stack_class_t stack_class) {
     ++m_extant;
-    if (m_cache.empty()) {
-        return new coro_t(m_dispatch);
+    intrusive_list_t<coro_t> &cache = m_cache[static_cast<size_t>(stack_class)];
+    if (cache.empty() && stack_class != stack_class_t::Compact) {
+        refill(stack_class);
+    }
+    if (cache.empty()) {
+        return new coro_t(m_dispatch, stack_class);
     }
 
-    return m_cache.pop_front();
+    // Drop any spawn parameters left at the top of the stack by its last use
+    coro_t *res = cache.pop_front();
+    res->m_stack_top = res->m_stack + res->m_stack_size;
+    return res;
+}
+
+void coro_cache_t::refill(stack_class_t stack_class) {
+    intrusive_list_t<coro_t> batch;
+    stack_pool_t::instance()->take(stack_class, m_max_cache_size / 2, &batch);
+    batch.clear([&] (coro_t *coro) {
+            coro->m_dispatch = m_dispatch;
+            m_stack_bytes.fetch_add(coro->m_stack_committed, std::memory_order_relaxed);
+            m_cache[static_cast<size_t>(stack_class)].push_back(coro);
+        });
+}
+
+void coro_cache_t::spill(stack_class_t stack_class, size_t count) {
+    // The least-recently used coroutines are at the back
+    intrusive_list_t<coro_t> &cache = m_cache[static_cast<size_t>(stack_class)];
+    intrusive_list_t<coro_t> batch;
+    for (size_t i = 0; i < count && !cache.empty(); ++i) {
+        coro_t *coro = cache.pop_back();
+        m_stack_bytes.fetch_sub(coro->m_stack_committed, std::memory_order_relaxed);
+        coro->m_dispatch = nullptr;
+        batch.push_front(coro);
+    }
+    stack_pool_t::instance()->give(stack_class, &batch);
 }
 
 void coro_cache_t::release(coro_t *coro) {
     assert(!coro->in_a_list());
     --m_extant;
-    if (m_cache.size() >= m_max_cache_size) {
+
+#if INDECOROUS_STACK_STATS
+    size_t depth = coro->stack_depth();
+    m_stack_depths.add(depth);
+    if (coro->m_spawn_site != nullptr) {
+        m_stack_depths_by_site[coro->m_spawn_site].add(depth);
+    }
+    if (coro->m_stack_histogram != nullptr) {
+        coro->m_stack_histogram->add(depth);
+    }
+    if (depth >= coro->m_stack_size - coro->m_stack_size / 8) {
+        logInfo("Coroutine spawned from %s used %zu of %zu stack bytes",
+                coro->m_spawn_site == nullptr ? "(unknown)" : coro->m_spawn_site,
+                depth, coro->m_stack_size);
+    }
+    coro->m_stack_histogram = nullptr;
+#endif
+    coro->m_spawn_site = nullptr;
+    coro->m_rpc_id = 0;
+    intrusive_list_t<coro_t> &cache = m_cache[static_cast<size_t>(coro->m_stack_class)];
+    if (cache.size() >= m_max_cache_size && coro->m_stack_class == stack_class_t::Compact) {
         delete coro;
     } else {
-        // Mark most of the coro_t's stack as not-needed so we don't use so much memory
-        // TODO: this is surprisingly slow for large stack sizes - maybe protect most of the
-        // stack and only grow it (and later MADV_DONTNEED the extra) when it overflows
-        // GUARANTEE_ERR(madvise(coro->m_stack + coro_t::s_page_size,
-        //                       coro_t::s_stack_size - coro_t::s_page_size * 2,
-        //                       MADV_DONTNEED) == 0);
+        // Only stacks that grew past the watermark need trimming, so this is
+        // usually free
+        coro->trim_stack();
+#if INDECOROUS_STACK_STATS
+        char *stack_end = coro->m_stack + coro->m_stack_size;
+        coro_t::fill_canary(stack_end - std::min(depth, coro->m_stack_committed), stack_end);
+#endif
+        cache.push_front(coro);
+        if (cache.size() > m_max_cache_size) {
+            spill(coro->m_stack_class, m_max_cache_size / 2);
+        }
+    }
+}
 
-        m_cache.push_front(coro);
+compact_stack_pool_t::compact_stack_pool_t(size_t stack_size) :
+    m_stack_size(stack_size),
+    m_regions(),
+    m_free() { }
+
+compact_stack_pool_t::~compact_stack_pool_t() {
+    assert(m_free.size() == m_regions.size() * s_stacks_per_region);
+    for (char *region : m_regions) {
+        GUARANTEE_ERR(munmap(region, m_stack_size * s_stacks_per_region) == 0);
+        stack_pool_t::instance()->note_unmap();
+    }
+}
+
+char *compact_stack_pool_t::get() {
+    if (m_free.empty()) {
+        // One mapping for many stacks - pages are only allocated once touched
+        size_t region_size = m_stack_size * s_stacks_per_region;
+        char *region = (char *)mmap(nullptr, region_size,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                                    -1, 0);
+        GUARANTEE_ERR(region != MAP_FAILED);
+        stack_pool_t::instance()->note_map();
+        m_regions.push_back(region);
+        for (size_t i = s_stacks_per_region; i > 0; --i) {
+            m_free.push_back(region + (i - 1) * m_stack_size);
+        }
     }
+
+    char *res = m_free.back();
+    m_free.pop_back();
+    return res;
+}
+
+void compact_stack_pool_t::release(char *stack) {
+    GUARANTEE_ERR(madvise(stack, m_stack_size, MADV_DONTNEED) == 0);
+    m_free.push_back(stack);
+}
+
+void coro_cache_t::disown(coro_t *coro) {
+    assert(!coro->in_a_list());
+    --m_extant;
+    m_stack_bytes.fetch_sub(coro->m_stack_committed, std::memory_order_relaxed);
+}
+
+void coro_cache_t::adopt(coro_t *coro) {
+    ++m_extant;
+    m_stack_bytes.fetch_add(coro->m_stack_committed, std::memory_order_relaxed);
+    coro->m_dispatch = m_dispatch;
+}
+
+deadline_t deadline_t::in_ns(uint64_t ns) {
+    return deadline_t(cycle_clock_t::now() + cycle_clock_t::from_ns(ns));
+}
+
+deadline_t deadline_t::in_ms(int64_t ms) {
+    return in_ns(ms <= 0 ? 0 : static_cast<uint64_t>(ms) * 1000 * 1000);
+}
+
+bool deadline_t::passed() const {
+    return is_set() && cycle_clock_t::now() >= m_ticks;
+}
+
+uint64_t deadline_t::remaining_ns() const {
+    uint64_t now = cycle_clock_t::now();
+    return (!is_set() || now >= m_ticks) ? 0 : cycle_clock_t::to_ns(m_ticks - now);
+}
+
+run_queue_t::run_queue_t() :
+        m_queues(),
+        m_deadline_heaps(),
+        m_passed_over(),
+        m_fifo_passed_over(),
+        m_size(0) { }
+
+run_queue_t::~run_queue_t() {
+    assert(m_size == 0);
+}
+
+bool run_queue_t::later_deadline(const coro_t *a, const coro_t *b) {
+    return b->m_deadline < a->m_deadline;
+}
+
+void run_queue_t::push_back(coro_t *coro) {
+    size_t level = static_cast<size_t>(coro->m_priority);
+    if (coro->m_deadline.is_set()) {
+        std::vector<coro_t *> &heap = m_deadline_heaps[level];
+        heap.push_back(coro);
+        std::push_heap(heap.begin(), heap.end(), &run_queue_t::later_deadline);
+    } else {
+        m_queues[level].push_back(coro);
+    }
+    ++m_size;
+}
+
+void run_queue_t::push_back_all(intrusive_list_t<coro_t> *coros) {
+    coro_t *first = coros->front();
+    if (first == nullptr) {
+        return;
+    } else if (first->m_deadline.is_set()) {
+        coros->clear([&] (coro_t *coro) { push_back(coro); });
+    } else {
+        m_size += coros->size();
+        m_queues[static_cast<size_t>(first->m_priority)].splice_back(coros);
+    }
+}
+
+coro_t *run_queue_t::pop_level(size_t level) {
+    std::vector<coro_t *> &heap = m_deadline_heaps[level];
+    intrusive_list_t<coro_t> &fifo = m_queues[level];
+    if (!heap.empty() && (fifo.empty() || m_fifo_passed_over[level] < s_starvation_limit)) {
+        if (!fifo.empty()) {
+            ++m_fifo_passed_over[level];
+        }
+        std::pop_heap(heap.begin(), heap.end(), &run_queue_t::later_deadline);
+        coro_t *res = heap.back();
+        heap.pop_back();
+        return res;
+    }
+
+    m_fifo_passed_over[level] = 0;
+    return fifo.pop_front();
+}
+
+coro_t *run_queue_t::pop_front() {
+    size_t chosen = num_priorities;
+    for (size_t i = 0; i < num_priorities; ++i) {
+        if (!level_empty(i)) {
+            if (chosen == num_priorities) {
+                chosen = i;
+            } else if (m_passed_over[i] >= s_starvation_limit) {
+                chosen = i;
+                break;
+            }
+        }
+    }
+
+    if (chosen == num_priorities) {
+        return nullptr;
+    }
+
+    for (size_t i = chosen + 1; i < num_priorities; ++i) {
+        if (!level_empty(i)) {
+            ++m_passed_over[i];
+        }
+    }
+    m_passed_over[chosen] = 0;
+
+    --m_size;
+    return pop_level(chosen);
 }
 
 dispatcher_t::dispatcher_t(shutdown_t *shutdown,
+                           shutdown_shard_t *shutdown_shard,
+                           stall_state_t *stall_state,
                            std::function<void()> initial_fn) :
         m_shutdown(shutdown),
+        m_shutdown_shard(shutdown_shard),
+        m_stall_state(stall_state),
         m_swap_permitted(true),
         m_coro_cache(32, this),
         m_run_queue(),
         m_running(nullptr),
         m_release(nullptr),
-        m_swap_count(0),
+        m_migrating(nullptr),
+        m_slice_end(0),
         m_main_context(),
-        m_initial_coro(m_coro_cache.get()),
+        m_initial_coro(m_coro_cache.get(stack_class_t::Medium)),
         m_initial_fn(std::move(initial_fn)),
-        m_coro_delta(0) {
-    // Save the currently running context
-    GUARANTEE_ERR(getcontext(&m_main_context) == 0);
+        m_retired(0),
+        m_ready_tasks(),
+        m_loop_iterations(0),
+        m_run_ticks(0),
+        m_poll_ticks(0),
+        m_deadline_misses(0),
+        m_signal_stack(new char[s_signal_stack_size]) {
+    stack_t signal_stack;
+    memset(&signal_stack, 0, sizeof(signal_stack));
+    signal_stack.ss_sp = m_signal_stack.get();
+    signal_stack.ss_size = s_signal_stack_size;
+    GUARANTEE_ERR(sigaltstack(&signal_stack, nullptr) == 0);
+    stack_fault_handler_t::acquire();
+    cycle_clock_t::calibrate();
 
     // Set up the initial coro context
-    makecontext(&m_initial_coro->m_context, &run_initial_coro, 0);
+    m_initial_coro->m_priority = priority_t::Normal;
+    m_initial_coro->m_deadline = deadline_t::none();
+    m_initial_coro->m_deadline_explicit = false;
+    m_initial_coro->make_context(&run_initial_coro, nullptr);
     m_run_queue.push_back(m_initial_coro);
 }
 
 dispatcher_t::~dispatcher_t() {
     assert(m_running == nullptr);
     assert(m_run_queue.size() == 0);
+    assert(m_ready_tasks.empty());
     assert(m_coro_cache.extant() == 0);
+
+    stack_fault_handler_t::release();
+    stack_t signal_stack;
+    memset(&signal_stack, 0, sizeof(signal_stack));
+    signal_stack.ss_flags = SS_DISABLE;
+    GUARANTEE_ERR(sigaltstack(&signal_stack, nullptr) == 0);
 }
 
-void dispatcher_t::run_initial_coro() {
+void dispatcher_t::run_initial_coro(void *) {
     dispatcher_t *dispatcher = thread_t::self()->dispatcher();
     coro_t *coro = dispatcher->m_running;
+#if INDECOROUS_CORO_STATS
+    coro->stats_begin();
+#endif
     dispatcher->m_initial_fn();
+    coro->m_locals.clear();
     dispatcher->enqueue_release(coro);
     coro->swap(nullptr);
 }
 
 void dispatcher_t::run() {
     assert(m_running == nullptr);
-    m_swap_count = 0;
-    m_coro_delta = 0;
+    uint64_t start = cycle_clock_t::now();
+    m_stall_state->run_begin();
+    m_slice_end = start + cycle_clock_t::from_ns(s_target_loop_latency_ns.load(std::memory_order_relaxed));
 
-    // Kick off the coroutines, they will give us back execution later
-    m_running = m_run_queue.pop_front();
-    if (m_running != nullptr) {
-        swapcontext(&m_main_context, &m_running->m_context);
-    }
+    do {
+        run_ready_tasks();
 
-    if (m_release != nullptr) {
-        m_coro_cache.release(m_release);
-        m_release = nullptr;
-    }
+        // Kick off the coroutines, they will give us back execution later
+        m_running = m_run_queue.pop_front();
+        if (m_running != nullptr) {
+            m_main_context.swap(&m_running->m_context);
+        }
+
+        after_swap();
+    } while (!idle() && cycle_clock_t::now() < m_slice_end);
 
     assert(m_running == nullptr);
-    if (m_coro_delta != 0) {
-        m_shutdown->update(m_coro_delta);
+    if (m_retired != 0) {
+        m_shutdown_shard->note_retired(m_retired);
+        m_retired = 0;
+        m_shutdown->check_done();
     }
+
+    m_stall_state->run_end();
+    m_run_ticks.store(m_run_ticks.load(std::memory_order_relaxed) + cycle_clock_t::now() - start,
+                      std::memory_order_relaxed);
+    m_loop_iterations.store(m_loop_iterations.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+}
+
+void dispatcher_t::note_deadline_miss() {
+    m_deadline_misses.store(m_deadline_misses.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+}
+
+void dispatcher_t::note_poll(uint64_t ticks) {
+    m_poll_ticks.store(m_poll_ticks.load(std::memory_order_relaxed) + ticks,
+                       std::memory_order_relaxed);
+}
+
+dispatcher_t::loop_stats_t dispatcher_t::loop_stats() const {
+    loop_stats_t res;
+    res.iterations = m_loop_iterations.load(std::memory_order_relaxed);
+    res.run_ns = cycle_clock_t::to_ns(m_run_ticks.load(std::memory_order_relaxed));
+    res.poll_ns = cycle_clock_t::to_ns(m_poll_ticks.load(std::memory_order_relaxed));
+    return res;
 }
 
 void dispatcher_t::note_new_task() {
-    m_coro_delta += 1;
+    m_shutdown_shard->note_created(1);
 }
 
 void dispatcher_t::note_accepted_task() {
-    m_coro_delta -= 1;
+    m_retired += 1;
+}
+
+void dispatcher_t::note_finished_task() {
+    m_retired += 1;
+}
+
+void dispatcher_t::enqueue_task(resumable_t *task) {
+    m_ready_tasks.push_back(task);
+}
+
+void dispatcher_t::run_ready_tasks() {
+    // Tasks made ready by these are left for the next pass, so that a task
+    // yielding in a loop cannot hold up the coroutines
+    intrusive_list_t<resumable_t> ready;
+    ready.splice_back(&m_ready_tasks);
+    while (!ready.empty()) {
+        ready.pop_front()->resume();
+    }
 }
 
 void dispatcher_t::enqueue_release(coro_t *coro) {
     assert(m_release == nullptr);
     m_release = coro;
-    --m_coro_delta;
+    m_retired += 1;
+}
+
+void dispatcher_t::after_swap() {
+    m_stall_state->note_switch();
+
+    if (m_release != nullptr) {
+        m_coro_cache.release(m_release);
+        m_release = nullptr;
+    }
+
+    if (m_migrating != nullptr) {
+        // The coroutine is now off its stack, so the other thread may resume it
+        coro_t *coro = m_migrating;
+        m_migrating = nullptr;
+        m_coro_cache.disown(coro);
+        coro->m_migrate_target->send_migration(coro);
+    }
 }
 
-coro_t::coro_t(dispatcher_t *dispatch) :
+coro_batch_t::state_t::state_t() :
+        remaining(0),
+        waiters(),
+        drainer() { }
+
+void coro_batch_t::state_t::finish_one() {
+    assert(remaining > 0);
+    if (--remaining == 0) {
+        waiters.clear([] (auto cb) { cb->wait_done(wait_result_t::Success); });
+    }
+}
+
+coro_batch_t::coro_batch_t() :
+        m_state(std::make_unique<state_t>()) { }
+
+coro_batch_t::coro_batch_t(coro_batch_t &&other) :
+        waitable_t(std::move(other)),
+        m_state(std::move(other.m_state)) {
+    if (m_state != nullptr) {
+        m_state->waiters.each([&] (auto cb) { cb->object_moved(this); });
+    }
+}
+
+coro_batch_t::~coro_batch_t() {
+    if (m_state != nullptr) {
+        m_state->drainer.drain();
+        m_state->waiters.clear([] (auto cb) { cb->wait_done(wait_result_t::ObjectLost); });
+    }
+}
+
+size_t coro_batch_t::remaining() const {
+    return m_state->remaining;
+}
+
+void coro_batch_t::add_wait(wait_callback_t *cb) {
+    if (m_state->remaining == 0) {
+        cb->wait_done(wait_result_t::Success);
+    } else {
+        m_state->waiters.push_back(cb);
+    }
+}
+
+void coro_batch_t::remove_wait(wait_callback_t *cb) {
+    m_state->waiters.remove(cb);
+}
+
+coro_t::coro_t(dispatcher_t *dispatch, stack_class_t stack_class) :
         m_dispatch(dispatch),
         m_context(),
+        m_priority(priority_t::Normal),
+        m_deadline(deadline_t::none()),
+        m_deadline_explicit(false),
+        m_stack_class(stack_class),
+        m_stack_size(s_stack_classes[static_cast<size_t>(stack_class)].size),
+        m_stack_watermark(s_stack_classes[static_cast<size_t>(stack_class)].watermark),
         m_stack(nullptr),
+        m_stack_top(nullptr),
+        m_stack_committed(0),
         m_valgrind_stack_id(-1),
         m_wait_callback(this),
         m_wait_result(wait_result_t::Success),
+        m_locals(),
+        m_home_target(nullptr),
+        m_migrate_target(nullptr),
+        m_spawn_site(nullptr),
+        m_rpc_id(0),
+#if INDECOROUS_STACK_STATS
+        m_stack_histogram(nullptr),
+#endif
+#if INDECOROUS_CORO_STATS
+        m_stats_mark(0),
+        m_wait_category(wait_category_t::Yield),
+        m_category_scoped(false),
+        m_scope_category(wait_category_t::Other),
+        m_run_ticks(0),
+        m_wait_ticks(),
+#endif
         m_interruptors() {
-    m_stack = (char *)mmap(nullptr, s_stack_size,
-                           PROT_READ | PROT_WRITE,
-                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_GROWSDOWN | MAP_STACK,
-                           -1, 0);
-    GUARANTEE_ERR(m_stack != MAP_FAILED);
+    m_stack_committed = m_stack_watermark;
+    if (m_stack_class == stack_class_t::Compact) {
+        m_stack = m_dispatch->m_coro_cache.m_compact_stacks.get();
+        uint64_t *band = reinterpret_cast<uint64_t *>(m_stack);
+        std::fill(band, band + s_page_size / sizeof(uint64_t), s_compact_band);
+#if !INDECOROUS_STACK_STATS
+        // Only the band is resident until the coroutine first blocks
+        m_stack_committed = s_page_size;
+#endif
+    } else {
+        // Reserve the address space for the whole stack, but only commit the top of it
+        m_stack = (char *)mmap(nullptr, m_stack_size,
+                               PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                               -1, 0);
+        GUARANTEE_ERR(m_stack != MAP_FAILED);
+        stack_pool_t::instance()->note_map();
+        GUARANTEE_ERR(mprotect(m_stack + m_stack_size - m_stack_committed, m_stack_committed,
+                               PROT_READ | PROT_WRITE) == 0);
+    }
+    m_stack_top = m_stack + m_stack_size;
+    m_dispatch->m_coro_cache.m_stack_bytes.fetch_add(m_stack_committed, std::memory_order_relaxed);
+#if INDECOROUS_STACK_STATS
+    fill_canary(m_stack_top - m_stack_committed, m_stack_top);
+#endif
+
+    m_valgrind_stack_id = VALGRIND_STACK_REGISTER(m_stack, m_stack + m_stack_size);
+}
+
+coro_t::~coro_t() {
+    VALGRIND_STACK_DEREGISTER(m_valgrind_stack_id);
+    if (m_stack_class == stack_class_t::Compact) {
+        m_dispatch->m_coro_cache.m_stack_bytes.fetch_sub(m_stack_committed, std::memory_order_relaxed);
+        m_dispatch->m_coro_cache.m_compact_stacks.release(m_stack);
+    } else {
+        // Coroutines held by the stack_pool_t belong to no dispatcher
+        if (m_dispatch != nullptr) {
+            m_dispatch->m_coro_cache.m_stack_bytes.fetch_sub(m_stack_committed, std::memory_order_relaxed);
+        }
+        GUARANTEE_ERR(munmap(m_stack, m_stack_size) == 0);
+        stack_pool_t::instance()->note_unmap();
+    }
+}
 
-    // Protect the last page of the stack so we get a segfault on overflow
-    GUARANTEE_ERR(mprotect(m_stack, s_page_size, PROT_NONE) == 0);
-    GUARANTEE_ERR(madvise(m_stack, s_page_size, MADV_DONTNEED) == 0);
+bool coro_t::grow_stack(char *addr) {
+    char *stack_end = m_stack + m_stack_size;
+    if (m_stack_class == stack_class_t::Compact ||
+        addr < m_stack + s_page_size || addr >= stack_end - m_stack_committed) {
+        return false;
+    }
 
-    GUARANTEE_ERR(getcontext(&m_context) == 0);
+    // Grow geometrically so deep stacks don't fault on every page
+    size_t needed = round_size_up(stack_end - addr, s_page_size);
+    size_t committed = std::min(std::max(needed, m_stack_committed * 2),
+                                m_stack_size - s_page_size);
+    if (mprotect(stack_end - committed, committed - m_stack_committed,
+                 PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
 
-    GUARANTEE_ERR(madvise(m_stack,
-                          s_stack_size - s_page_size,
-                          MADV_DONTNEED) == 0);
+    m_dispatch->m_coro_cache.m_stack_bytes.fetch_add(committed - m_stack_committed,
+                                                     std::memory_order_relaxed);
+#if INDECOROUS_STACK_STATS
+    fill_canary(stack_end - committed, stack_end - m_stack_committed);
+#endif
+    m_stack_committed = committed;
+    return true;
+}
 
-    m_context.uc_stack.ss_sp = m_stack;
-    m_context.uc_stack.ss_size = s_stackSize;
-    m_context.uc_link = nullptr;
+void coro_t::trim_stack() {
+    if (m_stack_class == stack_class_t::Compact) {
+        release_stack_below(m_stack + m_stack_size);
+    } else if (m_stack_committed > m_stack_watermark) {
+        size_t excess = m_stack_committed - m_stack_watermark;
+        char *bottom = m_stack + m_stack_size - m_stack_committed;
+        GUARANTEE_ERR(madvise(bottom, excess, MADV_DONTNEED) == 0);
+        GUARANTEE_ERR(mprotect(bottom, excess, PROT_NONE) == 0);
+
+        m_dispatch->m_coro_cache.m_stack_bytes.fetch_sub(excess, std::memory_order_relaxed);
+        m_stack_committed = m_stack_watermark;
+    }
+}
 
-    m_valgrind_stack_id = VALGRIND_STACK_REGISTER(m_stack, m_stack + s_stack_size);
+void coro_t::prefault_stack() {
+    volatile char *end = m_stack + m_stack_size;
+    for (volatile char *page = end - m_stack_committed; page < end; page += s_page_size) {
+        *page = *page;
+    }
 }
 
-coro_t::~coro_t() {
-    VALGRIND_STACK_DEREGISTER(m_valgrind_stack_id);
-    GUARANTEE_ERR(munmap(m_stack, s_stack_size) == 0);
+void coro_t::release_stack_below(UNUSED char *live) {
+#if !INDECOROUS_STACK_STATS
+    // Stack stats rely on the canary in these pages, so they are kept in that build
+    uintptr_t live_page = reinterpret_cast<uintptr_t>(live) & ~(s_page_size - 1);
+    char *begin = m_stack + s_page_size;
+    char *end = reinterpret_cast<char *>(live_page) - s_page_size;
+    if (end > begin) {
+        GUARANTEE_ERR(madvise(begin, end - begin, MADV_DONTNEED) == 0);
+    }
+
+    // Count the band and the pages from the live one down to `end` as resident
+    size_t resident = m_stack + m_stack_size - std::max(begin, end) + s_page_size;
+    std::atomic<size_t> &stack_bytes = m_dispatch->m_coro_cache.m_stack_bytes;
+    if (resident > m_stack_committed) {
+        stack_bytes.fetch_add(resident - m_stack_committed, std::memory_order_relaxed);
+    } else {
+        stack_bytes.fetch_sub(m_stack_committed - resident, std::memory_order_relaxed);
+    }
+    m_stack_committed = resident;
+#endif
+}
+
+void coro_t::check_compact_band() const {
+    // Check the whole page, a frame that skipped its top may have landed lower down
+    const uint64_t *band = reinterpret_cast<const uint64_t *>(m_stack);
+    const uint64_t *band_end = band + s_page_size / sizeof(uint64_t);
+    for (; band < band_end; ++band) {
+        if (*band != s_compact_band) {
+            logError("Compact coroutine stack overflowed");
+            ::abort();
+        }
+    }
+}
+
+#if INDECOROUS_STACK_STATS
+const uint64_t coro_t::s_stack_canary = 0x5AC4CA5A5AC4CA5AULL;
+
+// This is called from the stack fault handler, so it must be async-signal-safe
+void coro_t::fill_canary(char *begin, char *end) {
+    uint64_t *word_end = reinterpret_cast<uint64_t *>(end);
+    for (uint64_t *word = reinterpret_cast<uint64_t *>(begin); word < word_end; ++word) {
+        *word = s_stack_canary;
+    }
 }
 
+size_t coro_t::stack_depth() const {
+    char *stack_end = m_stack + m_stack_size;
+    const uint64_t *word = reinterpret_cast<const uint64_t *>(stack_end - m_stack_committed);
+    const uint64_t *word_end = reinterpret_cast<const uint64_t *>(stack_end);
+    while (word < word_end && *word == s_stack_canary) {
+        ++word;
+    }
+    return stack_end - reinterpret_cast<const char *>(word);
+}
+#endif
+
 [[ noreturn ]]
-void launch_coro(coro_start_t *start) {
+void launch_coro(void *param) {
+    auto start = reinterpret_cast<coro_start_t *>(param);
     auto self = start->self;
     auto hook = start->hook;
 
-    if (self->m_dispatch->m_release != nullptr) {
-        self->m_dispatch->m_coro_cache.release(self->m_dispatch->m_release);
-        self->m_dispatch->m_release = nullptr;
-    }
+#if INDECOROUS_CORO_STATS
+    self->stats_begin();
+#endif
+
+    self->m_dispatch->after_swap();
 
     if (start->type == spawn_type_t::Immediate) {
         // We're running immediately, put our parent on the back of the run queue
@@ -197,7 +781,14 @@ void launch_coro(coro_start_t *start) {
         (self->*hook)(start->params);
     }
 
-    delete start;
+    // The coro_start_t lives at the top of our own stack
+    start->~coro_start_t();
+
+    if (self->m_deadline_explicit && self->m_deadline.passed()) {
+        self->m_dispatch->note_deadline_miss();
+    }
+    self->m_locals.clear();
+    self->m_home_target = nullptr;
 
     assert(self->m_interruptors.size() == 0);
     self->m_dispatch->enqueue_release(self);
@@ -207,42 +798,52 @@ void launch_coro(coro_start_t *start) {
 
 void coro_t::begin(coro_start_t *start) {
     m_dispatch->note_new_task();
-    makecontext(&m_context, (void (*)())launch_coro, 1, start);
+    make_context(&launch_coro, start);
 }
 
-coro_t *coro_t::create() {
+void coro_t::make_context(context_fn_t fn, void *arg) {
+    m_context.make(m_stack, m_stack_top - m_stack, fn, arg);
+}
+
+coro_t *coro_t::create(stack_class_t stack_class) {
     dispatcher_t *dispatch = thread_t::self()->dispatcher();
-    auto res = dispatch->m_coro_cache.get();
+    auto res = dispatch->m_coro_cache.get(stack_class);
     assert(res->m_interruptors.size() == 0);
     return res;
 }
 
 void coro_t::swap(coro_t *next) {
     assert(m_dispatch->m_swap_permitted);
-    ++m_dispatch->m_swap_count;
+    if (m_stack_class == stack_class_t::Compact) {
+        check_compact_band();
+    }
+#if INDECOROUS_CORO_STATS
+    stats_swap_out();
+#endif
 
     if (next != nullptr) {
         // The current coroutine specified that it needs another coroutine scheduled
         // immediately - skip the queue and run it now.
         m_dispatch->m_running = next;
-        swapcontext(&m_context, &next->m_context);
+        m_context.swap(&next->m_context);
     } else if (m_dispatch->m_run_queue.empty() ||
-               m_dispatch->m_swap_count >= dispatcher_t::s_max_swaps_per_loop) {
+               cycle_clock_t::now() >= m_dispatch->m_slice_end) {
         m_dispatch->m_running = nullptr;
-        swapcontext(&m_context, &m_dispatch->m_main_context);
+        m_context.swap(&m_dispatch->m_main_context);
     } else {
         m_dispatch->m_running = m_dispatch->m_run_queue.pop_front();
         if (m_dispatch->m_running != this) {
-            swapcontext(&m_context, &m_dispatch->m_running->m_context);
+            m_context.swap(&m_dispatch->m_running->m_context);
         } else {
             // TODO: it seems bad that this can happen
         }
     }
 
-    if (m_dispatch->m_release != nullptr) {
-        m_dispatch->m_coro_cache.release(m_dispatch->m_release);
-        m_dispatch->m_release = nullptr;
-    }
+#if INDECOROUS_CORO_STATS
+    stats_swap_in();
+#endif
+
+    m_dispatch->after_swap();
 
     // Check if we did a wait that failed
     wait_result_t wait_result = m_wait_result;
@@ -252,12 +853,58 @@ void coro_t::swap(coro_t *next) {
     assert(m_dispatch->m_running == this);
 }
 
+#if INDECOROUS_CORO_STATS
+void coro_t::stats_begin() {
+    m_stats_mark = cycle_clock_t::now();
+    m_wait_category = wait_category_t::Yield;
+    m_category_scoped = false;
+    m_run_ticks = 0;
+    for (size_t i = 0; i < num_wait_categories; ++i) {
+        m_wait_ticks[i] = 0;
+    }
+}
+
+void coro_t::stats_swap_out() {
+    uint64_t now = cycle_clock_t::now();
+    m_run_ticks += now - m_stats_mark;
+    m_stats_mark = now;
+}
+
+void coro_t::stats_swap_in() {
+    uint64_t now = cycle_clock_t::now();
+    m_wait_ticks[static_cast<size_t>(m_wait_category)] += now - m_stats_mark;
+    m_stats_mark = now;
+    m_wait_category = wait_category_t::Yield;
+}
+
+void coro_t::note_wait_category(wait_category_t category) {
+    m_wait_category = m_category_scoped ? m_scope_category : category;
+}
+
+coro_stats_t coro_t::stats() const {
+    coro_stats_t res;
+    uint64_t run_ticks = m_run_ticks;
+    if (m_dispatch->m_running == this) {
+        run_ticks += cycle_clock_t::now() - m_stats_mark;
+    }
+    res.run_ns = cycle_clock_t::to_ns(run_ticks);
+    for (size_t i = 0; i < num_wait_categories; ++i) {
+        res.wait_ns[i] = cycle_clock_t::to_ns(m_wait_ticks[i]);
+    }
+    return res;
+}
+#endif
+
 coro_t* coro_t::self() {
     return thread_t::self()->dispatcher()->m_running;
 }
 
 void coro_t::wait() {
     assert(this == self());
+    if (m_stack_class == stack_class_t::Compact) {
+        char live;
+        release_stack_below(&live);
+    }
     swap(nullptr);
 }
 
@@ -267,6 +914,44 @@ void coro_t::yield() {
     coro->swap(nullptr);
 }
 
+void coro_t::migrate_to(target_t *target) {
+    GUARANTEE(target->is_local());
+    thread_t *thread = thread_t::self();
+    if (target == thread->target()) {
+        return;
+    }
+
+    coro_t *coro = self();
+    // Compact stacks belong to this thread's coro_cache_t
+    GUARANTEE(coro->m_stack_class != stack_class_t::Compact);
+    if (coro->m_home_target == nullptr) {
+        coro->m_home_target = thread->target();
+    }
+
+    // Anything an interruptor waits on belongs to the thread it was created on
+    coro->m_interruptors.each([] (interruptor_t *i) { i->suspend(); });
+
+    assert(coro->m_dispatch->m_migrating == nullptr);
+    coro->m_migrate_target = target;
+    coro->m_dispatch->m_migrating = coro;
+    coro->swap(nullptr);
+
+    coro->m_interruptors.each([] (interruptor_t *i) { i->resume(); });
+}
+
+void coro_t::migrate_home() {
+    target_t *home = self()->m_home_target;
+    if (home != nullptr) {
+        migrate_to(home);
+    }
+}
+
+void coro_t::accept_migration(coro_t *coro) {
+    dispatcher_t *dispatch = thread_t::self()->dispatcher();
+    dispatch->m_coro_cache.adopt(coro);
+    dispatch->m_run_queue.push_back(coro);
+}
+
 void coro_t::notify(wait_result_t result) {
     assert(!in_a_list());
     m_dispatch->m_run_queue.push_back(this);
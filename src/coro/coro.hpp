@@ -1,15 +1,21 @@
 #ifndef CORO_CORO_HPP_
 #define CORO_CORO_HPP_
 
-#include <ucontext.h>
-
 #include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include "common.hpp"
 #include "containers/intrusive.hpp"
+#include "coro/context.hpp"
+#include "coro/local.hpp"
+#include "coro/stats.hpp"
 #include "sync/promise.hpp"
 #include "sync/drainer.hpp"
 #include "sync/wait_object.hpp"
@@ -21,10 +27,13 @@ class coro_t;
 class dispatcher_t;
 class interruptor_t;
 class shutdown_t;
+class shutdown_shard_t;
+class stall_state_t;
+class target_t;
 
 typedef void(coro_t::*hook_fn_t)(void*);
 
-[[noreturn]] void launch_coro(coro_start_t *);
+[[noreturn]] void launch_coro(void *);
 
 enum class spawn_type_t {
     Immediate,
@@ -32,6 +41,88 @@ enum class spawn_type_t {
     Delayed,
 };
 
+// Coroutine stacks come in a few sizes, each with its own cache.  Most code
+// should use the default Medium stacks, Small stacks are for large numbers of
+// shallow coroutines and Large stacks for deep recursion.  See
+// coro_t::s_stack_classes for the actual sizes.
+//
+// Compact stacks are for huge numbers of mostly-blocked coroutines.  They are
+// packed together in large per-thread regions rather than mapped one by one,
+// and memory below the live part of the stack is given back whenever the
+// coroutine blocks.  They have no guard page - instead the whole bottom page is
+// filled with a band that is checked (fatally) whenever the coroutine swaps
+// out.  Only a single frame with more than a page of locals can jump the band
+// into the next stack, so those must not run on a Compact stack.
+enum class stack_class_t {
+    Small,
+    Medium,
+    Large,
+    Compact,
+};
+
+const size_t num_stack_classes = 4;
+
+// Runnable coroutines of a higher priority are run before those of a lower
+// priority, see run_queue_t.
+enum class priority_t {
+    High,
+    Normal,
+    Low,
+};
+
+const size_t num_priorities = 3;
+
+// An absolute point in time by which a coroutine should finish.  Within a
+// priority level, runnable coroutines with a deadline are run earliest-deadline
+// first, ahead of those without one, see run_queue_t.
+class deadline_t {
+public:
+    static deadline_t none() { return deadline_t(0); }
+    static deadline_t in_ns(uint64_t ns);
+    static deadline_t in_ms(int64_t ms);
+
+    bool is_set() const { return m_ticks != 0; }
+    bool passed() const;
+    uint64_t remaining_ns() const; // 0 if passed or not set
+
+    bool operator < (const deadline_t &other) const { return m_ticks < other.m_ticks; }
+
+private:
+    explicit deadline_t(uint64_t ticks) : m_ticks(ticks) { }
+    uint64_t m_ticks; // cycle_clock_t time, 0 if there is no deadline
+};
+
+// Optional parameters when spawning a coroutine, e.g.
+//   coro_t::spawn(spawn_options_t(stack_class_t::Large, priority_t::Low), fn);
+// A stack_class_t, priority_t or deadline_t may also be passed on its own.  By
+// default coroutines get a Medium stack and inherit the priority and deadline of
+// their parent.
+struct spawn_options_t {
+    spawn_options_t() :
+        stack_class(stack_class_t::Medium), inherit_priority(true), priority(priority_t::Normal),
+        deadline(deadline_t::none()) { }
+    spawn_options_t(stack_class_t _stack_class) :
+        stack_class(_stack_class), inherit_priority(true), priority(priority_t::Normal),
+        deadline(deadline_t::none()) { }
+    spawn_options_t(priority_t _priority) :
+        stack_class(stack_class_t::Medium), inherit_priority(false), priority(_priority),
+        deadline(deadline_t::none()) { }
+    spawn_options_t(stack_class_t _stack_class, priority_t _priority) :
+        stack_class(_stack_class), inherit_priority(false), priority(_priority),
+        deadline(deadline_t::none()) { }
+    spawn_options_t(deadline_t _deadline) :
+        stack_class(stack_class_t::Medium), inherit_priority(true), priority(priority_t::Normal),
+        deadline(_deadline) { }
+
+    stack_class_t stack_class;
+    bool inherit_priority;
+    priority_t priority;
+    deadline_t deadline; // Inherited from the parent if not set
+};
+
+template <typename T>
+using is_spawn_options = std::is_convertible<T, spawn_options_t>;
+
 // Used internally for handing over data when spawning a new coroutine
 struct coro_start_t {
     coro_start_t(coro_t *_self,
@@ -57,6 +148,26 @@ struct coro_start_t {
     DISABLE_COPYING(coro_start_t);
 };
 
+// Owned by a coro_cache_t, hands out slots for stack_class_t::Compact stacks
+class compact_stack_pool_t {
+public:
+    explicit compact_stack_pool_t(size_t stack_size);
+    ~compact_stack_pool_t();
+
+    // Returns the lowest address of a read-write stack of `stack_size` bytes
+    char *get();
+    void release(char *stack);
+
+private:
+    static const size_t s_stacks_per_region = 256;
+
+    const size_t m_stack_size;
+    std::vector<char *> m_regions;
+    std::vector<char *> m_free;
+
+    DISABLE_COPYING(compact_stack_pool_t);
+};
+
 class coro_cache_t {
 public:
     coro_cache_t(size_t max_cache_size,
@@ -65,57 +176,187 @@ public:
 
     size_t extant() const { return m_extant; }
 
-    coro_t *get();
+    // Committed stack memory of all coroutines owned by this thread, including
+    // cached ones - this is an upper bound on the resident stack memory.  This
+    // may be read from any thread.
+    size_t resident_stack_bytes() const { return m_stack_bytes.load(std::memory_order_relaxed); }
+
+    coro_t *get(stack_class_t stack_class);
     void release(coro_t *stack);
+
+    // Hand a suspended coroutine over to another thread's coro_cache_t
+    void disown(coro_t *coro);
+    void adopt(coro_t *coro);
+
+#if INDECOROUS_STACK_STATS
+    // Deepest stack use of the coroutines released on this thread, overall and
+    // by spawn_site_name() of what they ran
+    const stack_histogram_t &stack_depths() const { return m_stack_depths; }
+    const std::unordered_map<const char *, stack_histogram_t> &stack_depths_by_site() const {
+        return m_stack_depths_by_site;
+    }
+#endif
 private:
-    const size_t m_max_cache_size;
+    friend class coro_t;
+
+    // Batches of idle coroutines are moved to and from stack_pool_t
+    void refill(stack_class_t stack_class);
+    void spill(stack_class_t stack_class, size_t count);
+
+    const size_t m_max_cache_size; // Per stack class
     dispatcher_t *m_dispatch;
     size_t m_extant;
-    intrusive_list_t<coro_t> m_cache;
+    intrusive_list_t<coro_t> m_cache[num_stack_classes];
+
+    // Updated from the stack fault handler, so this must be lock-free
+    std::atomic<size_t> m_stack_bytes;
+
+    compact_stack_pool_t m_compact_stacks;
+
+#if INDECOROUS_STACK_STATS
+    stack_histogram_t m_stack_depths;
+    std::unordered_map<const char *, stack_histogram_t> m_stack_depths_by_site;
+#endif
 
     DISABLE_COPYING(coro_cache_t);
 };
 
+// Coroutines are run in strict priority order, except that when a non-empty
+// priority level has been passed over s_starvation_limit times in a row, it
+// gets the next turn.  Within a priority level, coroutines with a deadline are
+// run earliest-deadline first, then the rest in FIFO order - with the same
+// starvation limit for the FIFO coroutines.
+class run_queue_t {
+public:
+    run_queue_t();
+    ~run_queue_t();
+
+    void push_back(coro_t *coro);
+    coro_t *pop_front();
+
+    // Queues all of `coros`, which must share a priority and deadline, in one
+    // splice unless they have a deadline
+    void push_back_all(intrusive_list_t<coro_t> *coros);
+
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+
+private:
+    static const size_t s_starvation_limit;
+
+    bool level_empty(size_t level) const {
+        return m_queues[level].empty() && m_deadline_heaps[level].empty();
+    }
+    coro_t *pop_level(size_t level);
+
+    static bool later_deadline(const coro_t *a, const coro_t *b);
+
+    intrusive_list_t<coro_t> m_queues[num_priorities];
+    std::vector<coro_t *> m_deadline_heaps[num_priorities];
+    size_t m_passed_over[num_priorities];
+    size_t m_fifo_passed_over[num_priorities];
+    size_t m_size;
+
+    DISABLE_COPYING(run_queue_t);
+};
+
+// Something other than a coroutine for the dispatcher_t to run, i.e. a
+// suspended stackless task_t, see coro/task.hpp
+class resumable_t : public intrusive_node_t<resumable_t> {
+public:
+    virtual void resume() = 0;
+};
+
 // Not thread-safe, exactly one dispatcher_t per thread
 class dispatcher_t
 {
 public:
     dispatcher_t(shutdown_t *shutdown,
+                 shutdown_shard_t *shutdown_shard,
+                 stall_state_t *stall_state,
                  std::function<void()> initial_fn);
     ~dispatcher_t();
 
     void run();
 
-    // Called when an rpc is sent from this thread
+    // Called when an rpc is sent from this thread, or a coroutine or task is
+    // spawned.  Counted right away, unlike the retirements below, which are
+    // noted at the end of each run.
     void note_new_task();
     void note_accepted_task();
+    void note_deadline_miss();
+
+    // Called when a stackless task spawned on this thread finishes
+    void note_finished_task();
 
     void enqueue_release(coro_t *coro);
 
+    // Resumes `task` from the main context during the next run()
+    void enqueue_task(resumable_t *task);
+
+    // Whether there are no coroutines or tasks ready to run
+    bool idle() const { return m_run_queue.empty() && m_ready_tasks.empty(); }
+    size_t runnable() const { return m_run_queue.size() + m_ready_tasks.size(); }
+
+    // Called on the new stack after every swap to finish what the previous
+    // coroutine could not do on its own stack
+    void after_swap();
+
+    // Coroutines spawned with a deadline (not inherited) that finished after it,
+    // safe to read from other threads
+    uint64_t deadline_misses() const { return m_deadline_misses.load(std::memory_order_relaxed); }
+
+    // Event loop counters for this thread, safe to read from other threads
+    struct loop_stats_t {
+        uint64_t iterations;
+        uint64_t run_ns;
+        uint64_t poll_ns;
+    };
+    loop_stats_t loop_stats() const;
+    void note_poll(uint64_t ticks);
+
     shutdown_t * const m_shutdown;
+    shutdown_shard_t * const m_shutdown_shard;
+    stall_state_t * const m_stall_state;
 
     // Used by synchronization primitives with callbacks to fail an assert if the callback attempts
     // to swap coroutines
     bool m_swap_permitted;
 
     coro_cache_t m_coro_cache; // arena used to cache coro allocations
-    intrusive_list_t<coro_t> m_run_queue; // queue of contexts to run
+    run_queue_t m_run_queue; // queue of contexts to run
 
     coro_t * volatile m_running;
     coro_t *m_release; // Recently-finished coro_t to be released
+    coro_t *m_migrating; // Recently-suspended coro_t to be sent to another thread
 
-    size_t m_swap_count;
-    ucontext_t m_main_context; // Used to store the thread's main context
+    uint64_t m_slice_end; // cycle_clock_t time at which run() should return to polling
+    context_t m_main_context; // Used to store the thread's main context
 
-    static size_t s_max_swaps_per_loop;
+    // How long run() may keep swapping coroutines before going back to poll for
+    // events, read at the start of each run()
+    static std::atomic<uint64_t> s_target_loop_latency_ns;
 private:
     friend class ignore_coro_for_shutdown_t;
 
-    static void run_initial_coro();
+    static void run_initial_coro(void *);
+
+    // Resumes the tasks that were ready when this was called
+    void run_ready_tasks();
 
     coro_t *m_initial_coro;
     std::function<void()> m_initial_fn;
-    int64_t m_coro_delta;
+    uint64_t m_retired; // Not yet noted in m_shutdown_shard
+    intrusive_list_t<resumable_t> m_ready_tasks;
+
+    // Only written by the owning thread
+    std::atomic<uint64_t> m_loop_iterations;
+    std::atomic<uint64_t> m_run_ticks;
+    std::atomic<uint64_t> m_poll_ticks;
+    std::atomic<uint64_t> m_deadline_misses;
+
+    // Stack faults are handled on this stack, as the faulting stack is unusable
+    std::unique_ptr<char[]> m_signal_stack;
 
     DISABLE_COPYING(dispatcher_t);
 };
@@ -142,6 +383,38 @@ private:
     DISABLE_COPYING(coro_result_t);
 };
 
+// Completion of the coroutines started by one coro_t::spawn_many call.  Waiting
+// on it succeeds once all of their functions have returned.  Destroying it
+// interrupts any that are still running and waits for them to exit.
+class coro_batch_t final : public waitable_t {
+public:
+    coro_batch_t(coro_batch_t &&other);
+    ~coro_batch_t();
+
+    // Coroutines whose functions have not yet returned
+    size_t remaining() const;
+
+private:
+    friend class coro_t;
+    coro_batch_t();
+
+    void add_wait(wait_callback_t *cb) override final;
+    void remove_wait(wait_callback_t *cb) override final;
+
+    struct state_t {
+        state_t();
+        void finish_one();
+
+        size_t remaining;
+        intrusive_list_t<wait_callback_t> waiters;
+        drainer_t drainer; // Destroyed first, so the coroutines exit before the rest
+    };
+
+    std::unique_ptr<state_t> m_state;
+
+    DISABLE_COPYING(coro_batch_t);
+};
+
 class coro_t : public intrusive_node_t<coro_t> {
 public:
     // Give up execution indefinitely (until notified)
@@ -151,104 +424,262 @@ public:
     static void yield();
 
     // Create a coroutine and put it on the queue to run
-    template <typename Callable, typename... Args>
+    template <typename Callable, typename... Args,
+              typename = std::enable_if_t<!is_spawn_options<Callable>::value> >
     static auto spawn(Callable &&cb, Args &&...args) {
         return coro_t::self()->spawn_internal(
             spawn_type_t::Delayed,
+            spawn_options_t(),
             std::forward<Callable>(cb),
             std::forward<Args>(args)...
         );
     }
-    template <typename Callable, typename... Args>
+    template <typename Callable, typename... Args,
+              typename = std::enable_if_t<!is_spawn_options<Callable>::value> >
     static auto spawn_now(Callable &&cb, Args &&...args) {
         return coro_t::self()->spawn_internal(
             spawn_type_t::Immediate,
+            spawn_options_t(),
             std::forward<Callable>(cb),
             std::forward<Args>(args)...
         );
     }
-    template <typename Callable, typename... Args>
+    template <typename Callable, typename... Args,
+              typename = std::enable_if_t<!is_spawn_options<Callable>::value> >
     static void spawn_detached(Callable &&cb, Args &&...args) {
-        coro_t::self()->spawn_internal(
+        coro_t::self()->start_internal(
+            spawn_type_t::Detached,
+            spawn_options_t(),
+            drainer_lock_t::detached(),
+            detached_result_t(),
+            std::forward<Callable>(cb),
+            std::forward<Args>(args)...
+        );
+    }
+
+    // As above, but with a different stack size class or priority
+    template <typename Callable, typename... Args>
+    static auto spawn(spawn_options_t options, Callable &&cb, Args &&...args) {
+        return coro_t::self()->spawn_internal(
+            spawn_type_t::Delayed,
+            options,
+            std::forward<Callable>(cb),
+            std::forward<Args>(args)...
+        );
+    }
+    template <typename Callable, typename... Args>
+    static auto spawn_now(spawn_options_t options, Callable &&cb, Args &&...args) {
+        return coro_t::self()->spawn_internal(
+            spawn_type_t::Immediate,
+            options,
+            std::forward<Callable>(cb),
+            std::forward<Args>(args)...
+        );
+    }
+    template <typename Callable, typename... Args>
+    static void spawn_detached(spawn_options_t options, Callable &&cb, Args &&...args) {
+        coro_t::self()->start_internal(
             spawn_type_t::Detached,
+            options,
+            drainer_lock_t::detached(),
+            detached_result_t(),
             std::forward<Callable>(cb),
             std::forward<Args>(args)...
         );
     }
 
+    // Spawns a coroutine calling `cb(i)` for each i in [begin, end), or `cb(item)`
+    // for each item in `iterable`, and queues them all at once.  Each coroutine
+    // gets its own copy of `cb` and of its item, and they share one completion
+    // counter in the returned coro_batch_t rather than each having a future.
+    template <typename Callable>
+    static coro_batch_t spawn_many(size_t begin, size_t end, Callable &&cb) {
+        return spawn_many(spawn_options_t(), begin, end, std::forward<Callable>(cb));
+    }
+    template <typename Callable>
+    static coro_batch_t spawn_many(spawn_options_t options, size_t begin, size_t end, Callable &&cb) {
+        assert(begin <= end);
+        coro_t *parent = coro_t::self();
+        coro_batch_t batch;
+        intrusive_list_t<coro_t> coros;
+        for (size_t i = begin; i < end; ++i) {
+            parent->add_to_batch(options, &batch, &coros, cb, i);
+        }
+        parent->m_dispatch->m_run_queue.push_back_all(&coros);
+        return batch;
+    }
+    template <typename Iterable, typename Callable,
+              typename = std::enable_if_t<!std::is_integral<Iterable>::value &&
+                                          !is_spawn_options<Iterable>::value> >
+    static coro_batch_t spawn_many(const Iterable &iterable, Callable &&cb) {
+        return spawn_many(spawn_options_t(), iterable, std::forward<Callable>(cb));
+    }
+    template <typename Iterable, typename Callable,
+              typename = std::enable_if_t<!std::is_integral<Iterable>::value> >
+    static coro_batch_t spawn_many(spawn_options_t options, const Iterable &iterable, Callable &&cb) {
+        coro_t *parent = coro_t::self();
+        coro_batch_t batch;
+        intrusive_list_t<coro_t> coros;
+        for (auto const &item : iterable) {
+            parent->add_to_batch(options, &batch, &coros, cb, item);
+        }
+        parent->m_dispatch->m_run_queue.push_back_all(&coros);
+        return batch;
+    }
+
     // These are typically used by synchronization primitives
     static coro_t* self(); // Get the currently running coroutine on this thread
     wait_callback_t *wait_callback();
 
+    priority_t priority() const { return m_priority; }
+    deadline_t deadline() const { return m_deadline; }
+
+    // Continue running the current coroutine on the thread of `target`, which
+    // must be a local target.  Interruptors created on the previous thread are
+    // suspended until the coroutine returns there, and the coroutine always
+    // returns to the thread it was spawned on before its result is fulfilled.
+    // Interruptors inherited from a parent coroutine cannot be migrated.
+    static void migrate_to(target_t *target);
+    static void migrate_home();
+
+    // Values of coro_local_t slots for this coroutine
+    coro_locals_t *locals() { return &m_locals; }
+
+    // What the coroutine was spawned to run, for diagnostics - the spawn_site_name()
+    // of its function, and the value of the rpc_id_t it is handling if any, else 0
+    const char *spawn_site() const { return m_spawn_site; }
+    uint64_t rpc_id() const { return m_rpc_id; }
+
+#if INDECOROUS_STACK_STATS
+    // Also record this coroutine's deepest stack use in `histogram` when it exits,
+    // e.g. to group stack use by RPC
+    void set_stack_histogram(stack_histogram_t *histogram) { m_stack_histogram = histogram; }
+#endif
+
+#if INDECOROUS_CORO_STATS
+    // Time spent running and blocked since this coroutine started, including
+    // the current run if it is the running coroutine
+    coro_stats_t stats() const;
+#endif
+
 private:
     friend class scheduler_t;
     friend class dispatcher_t;
-    friend void launch_coro(coro_start_t *);
+    friend class run_queue_t;
+    friend void launch_coro(void *);
     friend class waitable_t;
     friend class coro_cache_t;
+    friend class stack_pool_t;
+    friend class stack_fault_handler_t;
+    friend class message_hub_t;
+
+    // Stand-in for a promise_t when nobody is interested in the result
+    struct detached_result_t {
+        template <typename T>
+        void fulfill(T &&) { }
+        void fulfill() { }
+    };
 
     template <typename Callable, typename... Args,
-              typename Res = typename std::result_of<Callable(Args...)>::type,
-              typename Tuple =
-                   std::tuple<promise_t<Res>,
-                       typename std::remove_reference<Callable>::type,
-                       typename std::remove_reference<Args>::type... >>
-    typename std::enable_if<!std::is_member_function_pointer<Callable>::value, coro_result_t<Res> >::type
-    spawn_internal(spawn_type_t type, Callable &&cb, Args &&...args) {
+              typename Res = typename std::result_of<Callable(Args...)>::type>
+    coro_result_t<Res> spawn_internal(spawn_type_t type, spawn_options_t options,
+                                      Callable &&cb, Args &&...args) {
         promise_t<Res> promise;
-        coro_t *coro = coro_t::create();
         coro_result_t<Res> res(promise.get_future());
-        // TODO: put this somewhere in the stack for the new coroutine - it'll save an allocation each call
-        // TODO: two allocations here is shitty af
-        coro_start_t *start = new coro_start_t(
-            coro,
-            &coro_t::hook<Res, Tuple, 2>,
-            new Tuple(std::move(promise), std::forward<Callable>(cb), std::forward<Args>(args)...),
-            this,
-            type,
-            type == spawn_type_t::Detached ? drainer_lock_t::detached() : res.m_drainer.lock()
-        );
-
-        coro->begin(start);
+        start_internal(type,
+                       options,
+                       res.m_drainer.lock(),
+                       std::move(promise),
+                       std::forward<Callable>(cb),
+                       std::forward<Args>(args)...);
+        return res;
+    }
 
+    // The parameters and the coro_start_t are constructed at the top of the new
+    // coroutine's stack, so this does not allocate if the coro_cache_t is warm.
+    template <typename Result, typename Callable, typename... Args>
+    void start_internal(spawn_type_t type, spawn_options_t options, drainer_lock_t &&lock,
+                        Result &&result, Callable &&cb, Args &&...args) {
+        coro_t *coro = create_internal(type, options, std::move(lock),
+                                       std::forward<Result>(result),
+                                       std::forward<Callable>(cb),
+                                       std::forward<Args>(args)...);
         if (type == spawn_type_t::Immediate) {
             swap(coro);
         } else {
             m_dispatch->m_run_queue.push_back(coro);
         }
-        return res;
     }
 
-    template <typename Callable, typename... Args,
+    // As start_internal, but leaves the new coroutine to the caller to queue
+    template <typename Result, typename Callable, typename... Args,
               typename Res = typename std::result_of<Callable(Args...)>::type,
               typename Tuple =
-                   std::tuple<promise_t<Res>,
+                   std::tuple<Result,
                        typename std::remove_reference<Callable>::type,
-                       typename std::remove_reference<Args>::type... >>
-    typename std::enable_if<std::is_member_function_pointer<Callable>::value, coro_result_t<Res> >::type
-    spawn_internal(spawn_type_t type, Callable &&cb, Args &&...args) {
-        promise_t<Res> promise;
-        coro_t *coro = coro_t::create();
-        coro_result_t<Res> res(promise.get_future());
-        // TODO: put this somewhere in the stack for the new coroutine - it'll save an allocation each call
-        // TODO: two allocations here is shitty
-        coro_start_t *start = new coro_start_t(
+                       typename std::remove_reference<Args>::type... >,
+              size_t ArgOffset = std::is_member_function_pointer<Callable>::value ? 3 : 2>
+    coro_t *create_internal(spawn_type_t type, spawn_options_t options, drainer_lock_t &&lock,
+                            Result &&result, Callable &&cb, Args &&...args) {
+        coro_t *coro = coro_t::create(options.stack_class);
+        coro->m_priority = options.inherit_priority ? m_priority : options.priority;
+        coro->m_deadline_explicit = options.deadline.is_set();
+        coro->m_deadline = coro->m_deadline_explicit ? options.deadline : m_deadline;
+        coro->m_spawn_site = spawn_site_name<typename std::decay<Callable>::type>();
+        if (!m_locals.empty()) {
+            coro->m_locals.inherit_from(m_locals);
+        }
+        Tuple *params = coro->emplace_on_stack<Tuple>(std::forward<Result>(result),
+                                                      std::forward<Callable>(cb),
+                                                      std::forward<Args>(args)...);
+        coro_start_t *start = coro->emplace_on_stack<coro_start_t>(
             coro,
-            &coro_t::hook<Res, Tuple, 3>,
-            new Tuple(std::move(promise), std::forward<Callable>(cb), std::forward<Args>(args)...),
+            &coro_t::hook<Res, Tuple, ArgOffset>,
+            params,
             this,
             type,
-            type == spawn_type_t::Detached ? drainer_lock_t::detached() : res.m_drainer.lock()
+            std::move(lock)
         );
 
         coro->begin(start);
+        return coro;
+    }
 
-        if (type == spawn_type_t::Immediate) {
-            swap(coro);
-        } else {
-            m_dispatch->m_run_queue.push_back(coro);
+    // Counts down a coro_batch_t when the coroutine's function returns
+    struct batch_result_t {
+        explicit batch_result_t(coro_batch_t::state_t *_state) : state(_state) { }
+        template <typename T>
+        void fulfill(T &&) { state->finish_one(); }
+        void fulfill() { state->finish_one(); }
+        coro_batch_t::state_t *state;
+    };
+
+    template <typename Callable, typename Item>
+    void add_to_batch(spawn_options_t options, coro_batch_t *batch,
+                      intrusive_list_t<coro_t> *coros, Callable &cb, Item &&item) {
+        coros->push_back(create_internal(spawn_type_t::Delayed,
+                                         options,
+                                         batch->m_state->drainer.lock(),
+                                         batch_result_t(batch->m_state.get()),
+                                         cb,
+                                         std::forward<Item>(item)));
+        ++batch->m_state->remaining;
+    }
+
+    // Reserves space below any previous reservations at the top of a coroutine's
+    // stack before it is started - this is only valid until the coroutine exits.
+    template <typename T, typename... Args>
+    T *emplace_on_stack(Args &&...args) {
+        uintptr_t top = reinterpret_cast<uintptr_t>(m_stack_top);
+        m_stack_top = reinterpret_cast<char *>((top - sizeof(T)) & ~(alignof(T) - 1));
+        // Leave most of the stack for the coroutine, and commit the pages the
+        // parent is about to write
+        GUARANTEE(m_stack + m_stack_size - m_stack_top < static_cast<ptrdiff_t>(m_stack_size / 2));
+        if (m_stack_class != stack_class_t::Compact &&
+            m_stack_top < m_stack + m_stack_size - m_stack_committed) {
+            GUARANTEE(grow_stack(m_stack_top));
         }
-        return res;
+        return new (m_stack_top) T(std::forward<Args>(args)...);
     }
 
     template <typename Res, typename Tuple, size_t ArgOffset>
@@ -257,38 +688,69 @@ private:
         runner_t<Res>::run(
                 std::make_index_sequence<std::tuple_size<Tuple>::value - ArgOffset>{},
                 params);
-        delete params;
+        params->~Tuple();
     }
 
     template <typename Res>
     class runner_t {
     public:
-        template <size_t... N, typename Callable, typename... Args>
+        template <size_t... N, typename Result, typename Callable, typename... Args>
         static typename std::enable_if<!std::is_member_function_pointer<Callable>::value, void>::type
-        run(std::integer_sequence<size_t, N...>, std::tuple<promise_t<Res>, Callable, Args...> *args) {
-            promise_t<Res> promise(std::get<0>(std::move(*args)));
-            promise.fulfill(std::get<1>(*args)(std::get<N+2>(std::move(*args))...));
+        run(std::integer_sequence<size_t, N...>, std::tuple<Result, Callable, Args...> *args) {
+            Result result(std::get<0>(std::move(*args)));
+            Res value(std::get<1>(*args)(std::get<N+2>(std::move(*args))...));
+            coro_t::migrate_home();
+            result.fulfill(std::forward<Res>(value));
         }
 
-        template <size_t... N, typename Callable, typename... Args>
+        template <size_t... N, typename Result, typename Callable, typename... Args>
         static typename std::enable_if<std::is_member_function_pointer<Callable>::value, void>::type
-        run(std::integer_sequence<size_t, N...>, std::tuple<promise_t<Res>, Callable, Args...> *args) {
-            promise_t<Res> promise(std::get<0>(std::move(*args)));
-            promise.fulfill((std::get<2>(std::move(*args))->*std::get<1>(std::move(*args)))(std::get<N+3>(std::move(*args))...));
+        run(std::integer_sequence<size_t, N...>, std::tuple<Result, Callable, Args...> *args) {
+            Result result(std::get<0>(std::move(*args)));
+            Res value((std::get<2>(std::move(*args))->*std::get<1>(std::move(*args)))(std::get<N+3>(std::move(*args))...));
+            coro_t::migrate_home();
+            result.fulfill(std::forward<Res>(value));
         }
     };
 
-    explicit coro_t(dispatcher_t *dispatch);
+    coro_t(dispatcher_t *dispatch, stack_class_t stack_class);
     ~coro_t();
 
     void begin(coro_start_t *start);
+    void make_context(context_fn_t fn, void *arg);
     void swap(coro_t *next);
 
+    // Called from the stack fault handler when `addr` faulted while this coroutine
+    // was running, or before the parent writes spawn parameters at `addr`.
+    // Returns false if `addr` was not in the uncommitted stack.
+    bool grow_stack(char *addr);
+
+    // Release any stack memory committed beyond the watermark
+    void trim_stack();
+
+    // Touch every committed page, keeping its contents, so none fault on next use
+    void prefault_stack();
+
+    // Compact stacks only - give back the memory more than a page below `live`,
+    // the lowest address still in use.  The bottom page holds s_compact_band.
+    void release_stack_below(char *live);
+    void check_compact_band() const;
+    static const uint64_t s_compact_band;
+
+#if INDECOROUS_STACK_STATS
+    static const uint64_t s_stack_canary;
+    static void fill_canary(char *begin, char *end);
+
+    // Bytes from the top of the stack to the deepest overwritten canary
+    size_t stack_depth() const;
+#endif
+
     void notify(wait_result_t result);
 
-    static coro_t *create();
+    static coro_t *create(stack_class_t stack_class);
 
-    static const size_t s_stackSize = 65535; // TODO: This is probably way too small
+    // Called on the destination thread of migrate_to()
+    static void accept_migration(coro_t *coro);
 
     // Interface for interruptors to register/deregister themselves
     friend class interruptor_t;
@@ -299,6 +761,14 @@ private:
     friend class multiple_waiter_t;
     interruptor_t *get_interruptor();
 
+#if INDECOROUS_CORO_STATS
+    friend class wait_category_scope_t;
+    void stats_begin();
+    void stats_swap_out();
+    void stats_swap_in();
+    void note_wait_category(wait_category_t category);
+#endif
+
     // Use this rather than inherit from it directly to avoid ugly multiple inheritance
     // of intrusive_node_t.
     class coro_wait_callback_t : public wait_callback_t {
@@ -312,15 +782,55 @@ private:
         DISABLE_COPYING(coro_wait_callback_t);
     };
 
+    // Each stack reserves `size` bytes of address space, of which only the top
+    // `watermark` bytes are initially committed.  The rest is protected and
+    // committed on demand by the stack fault handler, except for the bottom page
+    // which is a guard page.  Only faults from the coroutine itself commit more -
+    // a system call writing to untouched stack memory fails with EFAULT, so big
+    // stack buffers must be written before they are handed to the kernel.
+    struct stack_class_info_t {
+        size_t size;
+        size_t watermark;
+    };
+
+    static stack_class_info_t make_stack_class(size_t size, size_t watermark);
+
     static const size_t s_page_size;
-    static const size_t s_stack_size;
+    static const stack_class_info_t s_stack_classes[num_stack_classes];
 
     dispatcher_t *m_dispatch;
-    ucontext_t m_context;
+    context_t m_context;
+    priority_t m_priority;
+    deadline_t m_deadline;
+    bool m_deadline_explicit; // Whether m_deadline was given at spawn rather than inherited
+    const stack_class_t m_stack_class;
+    const size_t m_stack_size;
+    const size_t m_stack_watermark;
     char *m_stack;
+    char *m_stack_top; // Top of the stack below any spawn parameters
+    size_t m_stack_committed; // Bytes of the stack that are read-write (resident for Compact)
     int m_valgrind_stack_id;
     coro_wait_callback_t m_wait_callback;
     wait_result_t m_wait_result;
+    coro_locals_t m_locals;
+    target_t *m_home_target; // Set on the first migrate_to()
+    target_t *m_migrate_target;
+
+    const char *m_spawn_site; // spawn_site_name() of what the coroutine runs
+    uint64_t m_rpc_id; // Set while running an RPC handler
+
+#if INDECOROUS_STACK_STATS
+    stack_histogram_t *m_stack_histogram;
+#endif
+
+#if INDECOROUS_CORO_STATS
+    uint64_t m_stats_mark; // cycle_clock_t time of the last swap in or out
+    wait_category_t m_wait_category; // Category of the current or next block
+    bool m_category_scoped; // Set by wait_category_scope_t
+    wait_category_t m_scope_category;
+    uint64_t m_run_ticks;
+    uint64_t m_wait_ticks[num_wait_categories];
+#endif
 
     friend class interruptor_clear_t;
     intrusive_list_t<interruptor_t> m_interruptors;
@@ -331,20 +841,22 @@ private:
 // Specialization for void-returning functions
 template <> class coro_t::runner_t<void> {
 public:
-    template <size_t... N, typename Callable, typename... Args>
+    template <size_t... N, typename Result, typename Callable, typename... Args>
     static typename std::enable_if<!std::is_member_function_pointer<Callable>::value, void>::type
-    run(std::integer_sequence<size_t, N...>, std::tuple<promise_t<void>, Callable, Args...> *args) {
-        promise_t<void> promise(std::get<0>(std::move(*args)));
+    run(std::integer_sequence<size_t, N...>, std::tuple<Result, Callable, Args...> *args) {
+        Result result(std::get<0>(std::move(*args)));
         std::get<1>(std::move(*args))(std::get<N+2>(std::move(*args))...);
-        promise.fulfill();
+        coro_t::migrate_home();
+        result.fulfill();
     }
 
-    template <size_t... N, typename Callable, typename... Args>
+    template <size_t... N, typename Result, typename Callable, typename... Args>
     static typename std::enable_if<std::is_member_function_pointer<Callable>::value, void>::type
-    run(std::integer_sequence<size_t, N...>, std::tuple<promise_t<void>, Callable, Args...> *args) {
-        promise_t<void> promise(std::get<0>(std::move(*args)));
+    run(std::integer_sequence<size_t, N...>, std::tuple<Result, Callable, Args...> *args) {
+        Result result(std::get<0>(std::move(*args)));
         (std::get<2>(std::move(*args))->*std::get<1>(std::move(*args)))(std::get<N+3>(std::move(*args))...);
-        promise.fulfill();
+        coro_t::migrate_home();
+        result.fulfill();
     }
 };
 
@@ -0,0 +1,47 @@
+#include "coro/cycle_clock.hpp"
+
+#include "common.hpp"
+
+namespace indecorous {
+
+const uint64_t ns_per_ms = 1000000;
+
+uint64_t cycle_clock_t::monotonic_ns() {
+    struct timespec ts;
+    GUARANTEE_ERR(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 * ns_per_ms + ts.tv_nsec;
+}
+
+uint64_t cycle_clock_t::ticks_per_ms() {
+#if INDECOROUS_HAS_TSC
+    // Spin for a couple of milliseconds to get a stable ratio
+    static const uint64_t res = [] {
+        const uint64_t calibration_ns = 2 * ns_per_ms;
+        uint64_t start_ns = monotonic_ns();
+        uint64_t start_ticks = __rdtsc();
+        uint64_t end_ns;
+        do {
+            end_ns = monotonic_ns();
+        } while (end_ns - start_ns < calibration_ns);
+        uint64_t end_ticks = __rdtsc();
+        uint64_t ratio = (end_ticks - start_ticks) * ns_per_ms / (end_ns - start_ns);
+        return ratio == 0 ? 1 : ratio;
+    }();
+    return res;
+#else
+    return ns_per_ms;
+#endif
+}
+
+// Split the multiplication to avoid overflow on long intervals
+uint64_t cycle_clock_t::to_ns(uint64_t ticks) {
+    uint64_t ratio = ticks_per_ms();
+    return (ticks / ratio) * ns_per_ms + (ticks % ratio) * ns_per_ms / ratio;
+}
+
+uint64_t cycle_clock_t::from_ns(uint64_t ns) {
+    uint64_t ratio = ticks_per_ms();
+    return (ns / ns_per_ms) * ratio + (ns % ns_per_ms) * ratio / ns_per_ms;
+}
+
+} // namespace indecorous
@@ -0,0 +1,44 @@
+#ifndef CORO_CYCLE_CLOCK_HPP_
+#define CORO_CYCLE_CLOCK_HPP_
+
+#include <time.h>
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define INDECOROUS_HAS_TSC 1
+#else
+    #define INDECOROUS_HAS_TSC 0
+#endif
+
+namespace indecorous {
+
+// Cheap monotonic timestamps for scheduling decisions in the dispatcher.  On x86
+// this reads the TSC (assumed invariant), which is calibrated against
+// CLOCK_MONOTONIC once per process.  Elsewhere, ticks are CLOCK_MONOTONIC
+// nanoseconds.
+class cycle_clock_t {
+public:
+    static uint64_t now() {
+#if INDECOROUS_HAS_TSC
+        return __rdtsc();
+#else
+        return monotonic_ns();
+#endif
+    }
+
+    static uint64_t to_ns(uint64_t ticks);
+    static uint64_t from_ns(uint64_t ns);
+
+    // Forces calibration so the first caller of to_ns/from_ns does not pay for it
+    static void calibrate() { ticks_per_ms(); }
+
+private:
+    static uint64_t ticks_per_ms();
+    static uint64_t monotonic_ns();
+};
+
+} // namespace indecorous
+
+#endif // CORO_CYCLE_CLOCK_HPP_
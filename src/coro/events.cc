@@ -2,92 +2,144 @@
 
 #include <algorithm>
 #include <cstring>
-#include <memory>
-#include <sys/epoll.h>
+#include <limits>
 
 #include "sync/file_wait.hpp"
 #include "sync/timer.hpp"
 
 namespace indecorous {
 
+// Events that fail every wait on an fd
+static const uint32_t s_error_events = EPOLLERR | EPOLLHUP;
+
+// Registered fds are watched for everything, so their mask never changes
+static const uint32_t s_registered_events =
+    EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP | EPOLLET;
+
 events_t::file_info_t::file_info_t() :
-        m_callbacks(), m_last_used_events(0) { }
+        m_fd(-1), m_callbacks(), m_last_used_events(0), m_registered(false), m_ready(0) { }
 
 events_t::file_info_t::file_info_t(file_info_t &&other) :
+        intrusive_node_t<file_info_t>(std::move(other)),
+        m_fd(other.m_fd),
         m_callbacks(std::move(other.m_callbacks)),
-        m_last_used_events(other.m_last_used_events) {
+        m_last_used_events(other.m_last_used_events),
+        m_registered(other.m_registered),
+        m_ready(other.m_ready) {
+    other.m_fd = -1;
     other.m_last_used_events = 0;
+    other.m_registered = false;
+    other.m_ready = 0;
 }
 
 events_t::events_t() :
-        m_timer_list(),
+        m_timers(),
+        m_files(),
+        m_num_files(0),
         m_epoll_changes(),
-        m_file_map(),
-        m_epoll_set(::epoll_create1(EPOLL_CLOEXEC)) {
+        m_event_buffer(),
+        m_epoll_set(::epoll_create1(EPOLL_CLOEXEC)),
+        m_epoll_ctl_calls(0) {
     assert(m_epoll_set.valid());
 }
 
 events_t::~events_t() {
-
+    m_epoll_changes.clear([] (file_info_t *) { });
 }
 
-void events_t::add_timer(timer_callback_t *cb) {
-    // TODO: make an intrusive tree and use binary search?
-    timer_callback_t *cursor = m_timer_list.front();
-    while (cursor != nullptr && cursor->timeout() < cb->timeout()) {
-        cursor = m_timer_list.next(cursor);
+events_t::file_info_t *events_t::file_info(int fd) {
+    assert(fd >= 0);
+    size_t index = fd;
+    if (index >= m_files.size()) {
+        size_t old_size = m_files.size();
+        m_files.resize(std::max(index + 1, old_size * 2));
+        for (size_t i = old_size; i < m_files.size(); ++i) {
+            m_files[i].m_fd = i;
+        }
     }
+    return &m_files[index];
+}
 
-    if (cursor == nullptr) {
-        m_timer_list.push_back(cb);
-    } else {
-        m_timer_list.insert_before(cursor, cb);
-    }
+void events_t::add_timer(timer_callback_t *cb) {
+    m_timers.add(cb);
 }
 
 void events_t::remove_timer(timer_callback_t *cb) {
-    m_timer_list.remove(cb);
+    m_timers.remove(cb);
 }
 
 void events_t::add_file_wait(file_callback_t *cb) {
     assert(cb->event_mask() != 0);
-    auto it = m_file_map.find(cb->fd());
-    if (it == m_file_map.end()) {
-        auto res = m_file_map.emplace(cb->fd(), file_info_t());
-        assert(res.second);
-        it = res.first;
+    file_info_t *info = file_info(cb->fd());
+    if (!info->m_registered) {
+        info->m_callbacks.push_back(cb);
+        if (!info->in_a_list()) {
+            m_epoll_changes.push_back(info);
+        }
+    } else if ((info->m_ready & s_error_events) != 0) {
+        cb->file_callback(wait_result_t::ObjectLost);
+    } else if ((info->m_ready & cb->event_mask()) != 0) {
+        info->m_ready &= ~cb->event_mask();
+        cb->file_callback(wait_result_t::Success);
+    } else {
+        info->m_callbacks.push_back(cb);
     }
-    it->second.m_callbacks.push_back(cb);
-    m_epoll_changes.insert(cb->fd());
 }
 
 void events_t::remove_file_wait(file_callback_t *cb) {
-    auto it = m_file_map.find(cb->fd());
-    assert(it != m_file_map.end());
-    it->second.m_callbacks.remove(cb);
-    m_epoll_changes.insert(cb->fd());
+    file_info_t *info = file_info(cb->fd());
+    info->m_callbacks.remove(cb);
+    if (!info->m_registered && !info->in_a_list()) {
+        m_epoll_changes.push_back(info);
+    }
+}
+
+void events_t::register_file(int fd) {
+    file_info_t *info = file_info(fd);
+    GUARANTEE(!info->m_registered);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = s_registered_events;
+    event.data.fd = fd;
+
+    // Any waiters from before are now covered by the new mask
+    if (info->m_last_used_events == 0) {
+        ++m_num_files;
+    }
+    add_or_modify(fd, info->m_last_used_events != 0, &event);
+    info->m_last_used_events = s_registered_events;
+    info->m_registered = true;
+    info->m_ready = 0;
+    if (info->in_a_list()) {
+        m_epoll_changes.remove(info);
+    }
+}
+
+void events_t::unregister_file(int fd) {
+    file_info_t *info = file_info(fd);
+    GUARANTEE(info->m_registered);
+    info->m_registered = false;
+    info->m_ready = 0;
+
+    // Any remaining waiters go back to the usual level-triggered mask
+    assert(!info->in_a_list());
+    m_epoll_changes.push_back(info);
 }
 
 void events_t::check(bool wait) {
     int timeout = 0;
     if (wait) {
-        absolute_time_t start_time(0);
-        timeout = -1;
-        if (!m_timer_list.empty()) {
-            timeout = absolute_time_t::ms_diff(m_timer_list.front()->timeout(), start_time);
-
-            if (timeout < 0) {
-                timeout = 0;
-            }
-        }
+        timeout = std::min<int64_t>(m_timers.next_timeout_ms(timer_wheel_t::now_ms()),
+                                    std::numeric_limits<int>::max());
     }
 
     update_epoll();
     do_epoll_wait(timeout);
 
-    absolute_time_t end_time(0);
-    while (!m_timer_list.empty() && m_timer_list.front()->timeout() < end_time) {
-        timer_callback_t *cb = m_timer_list.pop_front();
+    // Callbacks may start or stop other timers, including ones in the batch
+    m_timers.advance(timer_wheel_t::now_ms());
+    while (timer_callback_t *cb = m_timers.pop_expired()) {
         cb->timer_callback(wait_result_t::Success);
     }
 }
@@ -96,40 +148,60 @@ void events_t::update_epoll() {
     struct epoll_event event;
     memset(&event, 0, sizeof(event));
 
-    for (int fd : m_epoll_changes) {
-        auto it = m_file_map.find(fd);
-        assert(it != m_file_map.end());
+    while (file_info_t *info = m_epoll_changes.pop_front()) {
+        assert(!info->m_registered);
 
         event.events = 0;
-        event.data.fd = fd;
-        file_callback_t *cb = it->second.m_callbacks.front();
+        event.data.fd = info->m_fd;
+        file_callback_t *cb = info->m_callbacks.front();
         while (cb != nullptr) {
             event.events |= cb->event_mask();
             assert(cb->event_mask() != 0);
-            cb = it->second.m_callbacks.next(cb);
+            cb = info->m_callbacks.next(cb);
         }
 
-        if (event.events == 0) {
-            assert(it->second.m_callbacks.empty());
-            m_file_map.erase(it);
+        if (event.events == info->m_last_used_events) {
+            // Waits were added and removed again since the last update
+        } else if (event.events == 0) {
+            assert(info->m_callbacks.empty());
+            info->m_last_used_events = 0;
+            --m_num_files;
 
             // If the fd was closed, it may have been automatically removed from the set
-            int res = ::epoll_ctl(m_epoll_set.get(), EPOLL_CTL_DEL, fd, &event);
+            ++m_epoll_ctl_calls;
+            int res = ::epoll_ctl(m_epoll_set.get(), EPOLL_CTL_DEL, info->m_fd, &event);
             GUARANTEE_ERR(res == 0 || errno == EBADF || errno == ENOENT);
         } else {
-            int task = it->second.m_last_used_events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
-            it->second.m_last_used_events = event.events;
-            GUARANTEE_ERR(::epoll_ctl(m_epoll_set.get(), task, fd, &event) == 0);
+            if (info->m_last_used_events == 0) {
+                ++m_num_files;
+            }
+            add_or_modify(info->m_fd, info->m_last_used_events != 0, &event);
+            info->m_last_used_events = event.events;
         }
     }
-    m_epoll_changes.clear();
+}
+
+void events_t::add_or_modify(int fd, bool added, struct epoll_event *event) {
+    ++m_epoll_ctl_calls;
+    if (::epoll_ctl(m_epoll_set.get(), added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, event) == 0) {
+        return;
+    }
+
+    // Closing the fd removed it from the set, or a dup of it kept it there
+    GUARANTEE_ERR(errno == (added ? ENOENT : EEXIST));
+    ++m_epoll_ctl_calls;
+    GUARANTEE_ERR(::epoll_ctl(m_epoll_set.get(), added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                              fd, event) == 0);
 }
 
 void events_t::do_epoll_wait(int timeout) {
-    size_t events_size = std::max<size_t>(m_file_map.size(), 1);
-    logDebug("Waiting on %zu file descriptors with timeout %d", m_file_map.size(), timeout);
-    std::unique_ptr<epoll_event[]> events(new epoll_event[events_size]);
-    int res = ::epoll_wait(m_epoll_set.get(), events.get(), events_size, timeout);
+    size_t events_size = std::max<size_t>(m_num_files, 1);
+    if (m_event_buffer.size() < events_size) {
+        m_event_buffer.resize(std::max(events_size, m_event_buffer.size() * 2));
+    }
+
+    logDebug("Waiting on %zu file descriptors with timeout %d", m_num_files, timeout);
+    int res = ::epoll_wait(m_epoll_set.get(), m_event_buffer.data(), events_size, timeout);
     if (res <= 0) {
         // Ignore EINTR, just allow a spurious wakeup
         assert(res == 0 || errno == EINTR);
@@ -137,28 +209,36 @@ void events_t::do_epoll_wait(int timeout) {
     }
 
     size_t count = res;
-    assert(count <= m_file_map.size());
+    assert(count <= m_num_files);
     for (size_t i = 0; i < count; ++i) {
-        int fd = events[i].data.fd;
-        uint32_t event_mask = events[i].events;
+        int fd = m_event_buffer[i].data.fd;
+        uint32_t event_mask = m_event_buffer[i].events;
 
-        auto it = m_file_map.find(fd);
-        assert(it != m_file_map.end());
+        assert(fd >= 0 && static_cast<size_t>(fd) < m_files.size());
+        file_info_t *info = &m_files[fd];
+
+        // Edges are only reported once, so they are kept until someone waits
+        if (info->m_registered) {
+            info->m_ready |= event_mask;
+        }
 
-        intrusive_list_t<file_callback_t> *cbs = &it->second.m_callbacks;
+        intrusive_list_t<file_callback_t> *cbs = &info->m_callbacks;
         file_callback_t *cursor = cbs->front();
 
+        uint32_t consumed = 0;
         while (cursor != nullptr) {
             file_callback_t *next = cbs->next(cursor);
-            if (event_mask & (EPOLLERR | EPOLLHUP)) {
+            if (event_mask & s_error_events) {
                 cursor->file_callback(wait_result_t::ObjectLost); // TODO: better error type for this?
                 cbs->remove(cursor);
             } else if ((cursor->event_mask() & event_mask) != 0) {
+                consumed |= cursor->event_mask();
                 cursor->file_callback(wait_result_t::Success);
                 cbs->remove(cursor);
             }
             cursor = next;
         }
+        info->m_ready &= ~consumed;
     }
 }
 
@@ -1,12 +1,14 @@
 #ifndef CORO_EVENTS_HPP_
 #define CORO_EVENTS_HPP_
 
-#include <unordered_map>
-#include <unordered_set>
+#include <sys/epoll.h>
+
+#include <vector>
 
 #include "common.hpp"
 #include "containers/file.hpp"
 #include "containers/intrusive.hpp"
+#include "coro/timer_wheel.hpp"
 
 namespace indecorous {
 
@@ -22,34 +24,65 @@ public:
     void add_timer(timer_callback_t *cb);
     void remove_timer(timer_callback_t *cb);
 
+    // A file wait may complete immediately if the fd is registered and known
+    // to be ready
     void add_file_wait(file_callback_t *cb);
     void remove_file_wait(file_callback_t *cb);
 
+    // Registered fds stay in the epoll set, edge-triggered for every event,
+    // until they are unregistered.  Readiness is cached between waits, so a
+    // wait only costs a system call if the fd is not yet known to be ready.
+    // Waiting on a registered fd consumes its readiness, so after each wait
+    // callers must read or write until EAGAIN before waiting again.  An fd
+    // must be unregistered before it is closed.
+    void register_file(int fd);
+    void unregister_file(int fd);
+
+    // Number of epoll_ctl calls made so far
+    uint64_t epoll_ctl_calls() const { return m_epoll_ctl_calls; }
+
     void check(bool wait);
 
 private:
     void update_epoll();
     void do_epoll_wait(int timeout);
 
-    // List of active timers ordered earliest to latest
-    intrusive_list_t<timer_callback_t> m_timer_list;
+    // Adds the fd to the set, or modifies it if `added`.  Falls back to the
+    // other operation when the fd was closed and reused since it was added.
+    void add_or_modify(int fd, bool added, struct epoll_event *event);
 
-    // Queued changed to the epoll set since the last wait
-    std::unordered_set<int> m_epoll_changes;
+    timer_wheel_t m_timers;
 
-    struct file_info_t {
+    struct file_info_t : public intrusive_node_t<file_info_t> {
     public:
         file_info_t();
         file_info_t(file_info_t &&other);
 
+        int m_fd;
         intrusive_list_t<file_callback_t> m_callbacks;
         uint32_t m_last_used_events;
+        bool m_registered;
+        uint32_t m_ready; // Events seen since the last wait, if registered
     private:
         DISABLE_COPYING(file_info_t);
     };
-    std::unordered_map<int, file_info_t> m_file_map;
+
+    // Grows the table to cover `fd`
+    file_info_t *file_info(int fd);
+
+    // Indexed by fd, so lookups neither hash nor allocate once the table has
+    // grown to cover the highest fd in use
+    std::vector<file_info_t> m_files;
+    size_t m_num_files; // Entries that are in the epoll set
+
+    // Entries changed since the last wait
+    intrusive_list_t<file_info_t> m_epoll_changes;
+
+    // Reused by every wait, grown to fit every fd in the epoll set
+    std::vector<epoll_event> m_event_buffer;
 
     scoped_fd_t m_epoll_set;
+    uint64_t m_epoll_ctl_calls;
 };
 
 } // namespace indecorous
@@ -0,0 +1,80 @@
+#include "coro/local.hpp"
+
+#include "coro/coro.hpp"
+
+namespace indecorous {
+
+coro_local_base_t::slot_info_t coro_local_base_t::s_slots[coro_local_base_t::s_max_slots];
+std::atomic<size_t> coro_local_base_t::s_reserved_slots(0);
+std::atomic<size_t> coro_local_base_t::s_num_slots(0);
+
+coro_local_base_t::coro_local_base_t(destroy_fn_t destroy_fn, clone_fn_t clone_fn, bool inheritable) :
+        m_slot(s_reserved_slots.fetch_add(1, std::memory_order_relaxed)) {
+    GUARANTEE(m_slot < s_max_slots);
+    s_slots[m_slot].destroy = destroy_fn;
+    s_slots[m_slot].clone = clone_fn;
+    s_slots[m_slot].inherit = inheritable;
+
+    // Wait for any lower slots still being filled, so num_slots() never
+    // covers an entry that isn't ready
+    size_t expected = m_slot;
+    while (!s_num_slots.compare_exchange_weak(expected, m_slot + 1,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+        expected = m_slot;
+    }
+}
+
+coro_locals_t *coro_local_base_t::current() {
+    coro_t *self = coro_t::self();
+    assert(self != nullptr);
+    return self->locals();
+}
+
+coro_locals_t::coro_locals_t() :
+        m_values(nullptr),
+        m_count(0) { }
+
+coro_locals_t::~coro_locals_t() {
+    clear();
+}
+
+void coro_locals_t::set(size_t slot, void *value) {
+    assert(slot < coro_local_base_t::num_slots());
+    if (m_values == nullptr) {
+        if (value == nullptr) {
+            return;
+        }
+        m_values.reset(new void *[coro_local_base_t::s_max_slots]());
+    }
+
+    void *old_value = m_values[slot];
+    m_values[slot] = value;
+    if (value != nullptr) {
+        ++m_count;
+    }
+    if (old_value != nullptr) {
+        --m_count;
+        coro_local_base_t::destroy(slot, old_value);
+    }
+}
+
+void coro_locals_t::inherit_from(const coro_locals_t &parent) {
+    size_t num_slots = coro_local_base_t::num_slots();
+    for (size_t i = 0; i < num_slots && parent.m_values != nullptr; ++i) {
+        if (parent.m_values[i] != nullptr && coro_local_base_t::inherit(i)) {
+            set(i, coro_local_base_t::clone(i, parent.m_values[i]));
+        }
+    }
+}
+
+void coro_locals_t::clear() {
+    size_t num_slots = coro_local_base_t::num_slots();
+    for (size_t i = 0; i < num_slots && m_count > 0; ++i) {
+        if (m_values[i] != nullptr) {
+            set(i, nullptr);
+        }
+    }
+}
+
+} // namespace indecorous
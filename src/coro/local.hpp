@@ -0,0 +1,124 @@
+#ifndef CORO_LOCAL_HPP_
+#define CORO_LOCAL_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "common.hpp"
+
+namespace indecorous {
+
+// The storage for coroutine-local values of a single coroutine.  Nothing is
+// allocated until a value is first set, and the slot array is kept when the
+// coro_t is cached for reuse.
+class coro_locals_t {
+public:
+    coro_locals_t();
+    ~coro_locals_t();
+
+    bool empty() const { return m_count == 0; }
+
+    void *get(size_t slot) const {
+        return m_values == nullptr ? nullptr : m_values[slot];
+    }
+
+    // Takes ownership of `value`, destroying any previous value in the slot
+    void set(size_t slot, void *value);
+
+    // Copies the values of the parent's inheritable slots, called on spawn
+    void inherit_from(const coro_locals_t &parent);
+
+    // Destroys all values, called when the coroutine exits
+    void clear();
+
+private:
+    std::unique_ptr<void *[]> m_values;
+    size_t m_count; // Number of non-null values
+
+    DISABLE_COPYING(coro_locals_t);
+};
+
+// Type-erased operations on the values of a coro_local_t slot
+class coro_local_base_t {
+public:
+    typedef void (*destroy_fn_t)(void *);
+    typedef void *(*clone_fn_t)(const void *);
+
+    static const size_t s_max_slots = 64;
+
+    static void destroy(size_t slot, void *value) { s_slots[slot].destroy(value); }
+    static void *clone(size_t slot, const void *value) { return s_slots[slot].clone(value); }
+    static bool inherit(size_t slot) { return s_slots[slot].inherit; }
+    static size_t num_slots() { return s_num_slots.load(std::memory_order_acquire); }
+
+protected:
+    coro_local_base_t(destroy_fn_t destroy_fn, clone_fn_t clone_fn, bool inheritable);
+
+    // The locals of the currently running coroutine
+    static coro_locals_t *current();
+
+    const size_t m_slot;
+
+private:
+    struct slot_info_t {
+        destroy_fn_t destroy;
+        clone_fn_t clone;
+        bool inherit;
+    };
+
+    static slot_info_t s_slots[s_max_slots];
+    static std::atomic<size_t> s_reserved_slots; // Slots handed out, possibly not filled yet
+    static std::atomic<size_t> s_num_slots; // Slots filled in, published in order
+
+    DISABLE_COPYING(coro_local_base_t);
+};
+
+enum class coro_local_inherit_t {
+    No,
+    Yes,
+};
+
+// A value of type T per coroutine, accessed in O(1) through a slot index.
+// Instances must have static storage duration, as slots are never freed:
+//   static coro_local_t<trace_id_t> trace_id(coro_local_inherit_t::Yes);
+//   trace_id.set(id);
+//   const trace_id_t *id = trace_id.get(); // nullptr if unset in this coroutine
+// Values of inheritable slots are copied into coroutines spawned after set().
+template <typename T>
+class coro_local_t : public coro_local_base_t {
+public:
+    explicit coro_local_t(coro_local_inherit_t inheritable = coro_local_inherit_t::No) :
+        coro_local_base_t(&coro_local_t::destroy_value,
+                          &coro_local_t::clone_value,
+                          inheritable == coro_local_inherit_t::Yes) { }
+
+    T *get() const {
+        return reinterpret_cast<T *>(current()->get(m_slot));
+    }
+
+    template <typename... Args>
+    T *set(Args &&...args) {
+        T *value = new T(std::forward<Args>(args)...);
+        current()->set(m_slot, value);
+        return value;
+    }
+
+    void reset() {
+        current()->set(m_slot, nullptr);
+    }
+
+private:
+    static void destroy_value(void *value) {
+        delete reinterpret_cast<T *>(value);
+    }
+
+    static void *clone_value(const void *value) {
+        return new T(*reinterpret_cast<const T *>(value));
+    }
+};
+
+} // namespace indecorous
+
+#endif // CORO_LOCAL_HPP_
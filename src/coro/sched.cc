@@ -8,25 +8,19 @@
 #include "coro/coro.hpp"
 #include "coro/shutdown.hpp"
 #include "coro/thread.hpp"
+#include "coro/watchdog.hpp"
 #include "utils.hpp"
 
 namespace indecorous {
 
 scheduler_t::scheduler_t(size_t num_coro_threads, shutdown_policy_t policy) :
-        m_running(false),
-        m_shared_registry(),
-        m_shutdown_policy(policy),
-        m_shutdown(),
-        m_destroying(false),
-        m_barrier(num_coro_threads + 2),
-        m_io_stream(),
-        m_io_target(&m_io_stream),
-        m_coro_threads(),
-        m_io_threads() {
-    construct_internal(num_coro_threads, 1);
-}
+        scheduler_t(num_coro_threads, 1, policy) { }
 
 scheduler_t::scheduler_t(size_t num_coro_threads, size_t num_io_threads, shutdown_policy_t policy) :
+        scheduler_t(num_coro_threads, num_io_threads, policy, thread_placement_t()) { }
+
+scheduler_t::scheduler_t(size_t num_coro_threads, size_t num_io_threads, shutdown_policy_t policy,
+                         const thread_placement_t &placement) :
         m_running(false),
         m_shared_registry(),
         m_shutdown_policy(policy),
@@ -34,13 +28,16 @@ scheduler_t::scheduler_t(size_t num_coro_threads, size_t num_io_threads, shutdow
         m_destroying(false),
         m_barrier(num_coro_threads + num_io_threads + 1),
         m_io_stream(),
-        m_io_target(&m_io_stream),
+        m_io_target(&m_io_stream, placement.io_thread()),
+        m_num_active(num_coro_threads),
+        m_coro_targets(),
         m_coro_threads(),
         m_io_threads() {
-    construct_internal(num_coro_threads, num_io_threads);
+    construct_internal(num_coro_threads, num_io_threads, placement);
 }
 
-void scheduler_t::construct_internal(size_t num_coro_threads, size_t num_io_threads) {
+void scheduler_t::construct_internal(size_t num_coro_threads, size_t num_io_threads,
+                                     const thread_placement_t &placement) {
     assert(num_coro_threads > 0);
 
     // Block signals on child threads (this will be inherited)
@@ -54,11 +51,11 @@ void scheduler_t::construct_internal(size_t num_coro_threads, size_t num_io_thre
     GUARANTEE(pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset) == 0);
 
     for (size_t i = 0; i < num_coro_threads; ++i) {
-        m_coro_threads.emplace_back(this, &m_io_target);
+        m_coro_threads.emplace_back(this, &m_io_target, placement.coro_thread(i));
     }
 
     for (size_t i = 0; i < num_io_threads; ++i) {
-        m_io_threads.emplace_back(this, &m_io_target, &m_io_stream);
+        m_io_threads.emplace_back(this, &m_io_target, &m_io_stream, placement.io_thread());
     }
 
     // Return SIGINT and SIGTERM to the previous state
@@ -69,9 +66,13 @@ void scheduler_t::construct_internal(size_t num_coro_threads, size_t num_io_thre
 
     // Tell the message hubs of each thread about the others
     for (auto &&t : m_coro_threads) {
+        m_coro_targets.push_back(t.thread()->target());
         all_thread_targets.push_back(t.thread()->target());
         for (auto &&u : m_coro_threads) {
             t.thread()->hub()->add_local_target(u.thread()->target());
+            if (&t != &u) {
+                t.thread()->add_steal_peer(u.thread());
+            }
         }
     }
 
@@ -104,7 +105,20 @@ scheduler_t::~scheduler_t() {
 }
 
 const std::vector<target_t *> &scheduler_t::local_targets() {
-    return m_coro_threads.begin()->thread()->hub()->local_targets();
+    return m_coro_targets;
+}
+
+void scheduler_t::resize(size_t num_active) {
+    GUARANTEE(num_active > 0 && num_active <= m_coro_threads.size());
+    if (m_num_active.exchange(num_active, std::memory_order_acq_rel) != num_active) {
+        // Blocked threads would not notice until something else woke them up
+        for (auto &&t : m_coro_threads) {
+            t.thread()->wake();
+        }
+        for (auto &&t : m_io_threads) {
+            t.thread()->wake();
+        }
+    }
 }
 
 target_t *scheduler_t::io_target() {
@@ -173,6 +187,15 @@ void scheduler_t::run() {
     m_running = true;
     m_shutdown->reset(initial_tasks);
 
+    std::vector<thread_t *> threads;
+    for (auto &&t : m_coro_threads) {
+        threads.push_back(t.thread());
+    }
+    for (auto &&t : m_io_threads) {
+        threads.push_back(t.thread());
+    }
+    stall_watchdog_t watchdog(std::move(threads));
+
     switch (m_shutdown_policy) {
     case shutdown_policy_t::Eager: {
             m_barrier.wait();
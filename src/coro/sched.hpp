@@ -9,6 +9,7 @@
 #include "coro/barrier.hpp"
 #include "coro/shutdown.hpp"
 #include "coro/thread.hpp"
+#include "coro/topology.hpp"
 #include "cross_thread/shared.hpp"
 #include "rpc/target.hpp"
 
@@ -24,16 +25,33 @@ class scheduler_t {
 public:
     scheduler_t(size_t num_coro_threads, shutdown_policy_t policy);
     scheduler_t(size_t num_coro_threads, size_t num_io_threads, shutdown_policy_t policy);
+    scheduler_t(size_t num_coro_threads, size_t num_io_threads, shutdown_policy_t policy,
+                const thread_placement_t &placement);
     ~scheduler_t();
 
+    // Every coro thread in order, including parked ones, see target_t::topology()
+    // for where each one runs
     const std::vector<target_t *> &local_targets();
     target_t *io_target();
 
-    // Broadcasts a given callback to all coro threads with no replies
+    // Only the first `num_active` coro threads take new work, so the pool can
+    // follow changes in CPU quota.  The others are parked: they are left out of
+    // every hub's local_targets(), do not steal, and block once they have
+    // finished the work already sent to them - their stealable messages are
+    // taken by the active threads.  Threads are only created on construction,
+    // so this is at most the number of coro threads, and at least one.  May be
+    // called from any thread, hubs catch up before their next dispatcher run.
+    void resize(size_t num_active);
+    size_t num_active() const { return m_num_active.load(std::memory_order_acquire); }
+
+    // Broadcasts a given callback to all active coro threads with no replies
     template <typename Callback, typename... Args>
     size_t broadcast_local(Args &&...args) {
-        return m_coro_threads.begin()->thread()->hub()->
-            broadcast_local_noreply<Callback>(std::forward<Args>(args)...);
+        size_t count = num_active();
+        for (size_t i = 0; i < count; ++i) {
+            m_coro_targets[i]->call_noreply<Callback>(std::forward<Args>(args)...);
+        }
+        return count;
     }
 
     // Creates a shared object of the given type that can be sent to local targets.
@@ -52,7 +70,8 @@ private:
     // Threads will use several of these members to synchronize by
     friend class thread_t;
 
-    void construct_internal(size_t num_coro_threads, size_t num_io_threads);
+    void construct_internal(size_t num_coro_threads, size_t num_io_threads,
+                            const thread_placement_t &placement);
 
     bool m_running;
     shared_registry_t m_shared_registry;
@@ -62,6 +81,8 @@ private:
     thread_barrier_t m_barrier;
     io_stream_t m_io_stream;
     local_target_t<io_stream_t> m_io_target;
+    std::atomic<size_t> m_num_active;
+    std::vector<target_t *> m_coro_targets;
     std::list<coro_thread_t> m_coro_threads;
     std::list<io_thread_t> m_io_threads;
 };
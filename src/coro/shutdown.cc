@@ -21,37 +21,93 @@ IMPL_STATIC_RPC(shutdown_rpc_t::finish_shutdown)() -> void {
     thread_t::self()->finish_shutdown();
 }
 
+shutdown_shard_t::shutdown_shard_t() :
+        m_created(0),
+        m_retired(0),
+        m_padding() { }
+
 shutdown_t::shutdown_t(std::vector<target_t *> targets) :
-   m_targets(std::move(targets)),
-   m_finish_sent(true),
-   m_active_count(0) { }
+        m_targets(std::move(targets)),
+        m_shards(new shutdown_shard_t[m_targets.size() + 1]),
+        m_external_shard(&m_shards[m_targets.size()]),
+        m_shutting_down(false),
+        m_finish_sent(true) { }
+
+shutdown_shard_t *shutdown_t::shard(target_t *target) {
+    for (size_t i = 0; i < m_targets.size(); ++i) {
+        if (m_targets[i] == target) {
+            return &m_shards[i];
+        }
+    }
+    UNREACHABLE();
+}
+
+void shutdown_t::reset(size_t initial_tasks) {
+    for (size_t i = 0; i <= m_targets.size(); ++i) {
+        m_shards[i].m_created.store(0, std::memory_order_relaxed);
+        m_shards[i].m_retired.store(0, std::memory_order_relaxed);
+    }
 
-void shutdown_t::reset(size_t initial_count) {
-   // The extra 1 is a dummy task to prevent shutdown until `begin_shutdown` is called
-    m_active_count = initial_count + 1;
+    // The extra 1 is a dummy task to prevent shutdown until `begin_shutdown` is called
+    m_external_shard->note_created(initial_tasks + 1);
+    m_shutting_down = false;
     m_finish_sent = false;
 }
 
 void shutdown_t::begin_shutdown() {
-    // This is called outside the context of a thread_t, so update manually
-    update(m_targets.size() - 1);
+    // This is called outside the context of a thread_t, so note the RPCs manually
+    m_external_shard->note_created(m_targets.size());
     for (auto &&t : m_targets) {
         t->call_noreply<shutdown_rpc_t::begin_shutdown>();
     }
+
+    m_shutting_down = true;
+    m_external_shard->note_retired(1);
+    check_done();
 }
 
-void shutdown_t::update(int64_t active_delta) {
-    uint64_t res = m_active_count.fetch_add(active_delta);
+void shutdown_t::check_done() {
+    // Callers have just written their shard or m_shutting_down.  Without a full
+    // fence, two threads doing this at once could each read the other's old
+    // values, and neither would see that shutdown is done.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_shutting_down.load(std::memory_order_relaxed) ||
+        m_finish_sent.load(std::memory_order_relaxed) ||
+        !quiescent()) {
+        return;
+    }
 
-    bool done = ((res + active_delta) == 0);
-    if (done && res != 0 && !m_finish_sent.load()) {
+    // Several threads may see the same quiescent state
+    bool expected = false;
+    if (m_finish_sent.compare_exchange_strong(expected, true)) {
         logInfo("All tasks finished, completing shutdown");
-        m_active_count.fetch_add(m_targets.size());
-        m_finish_sent.store(true);
         for (auto &&t : m_targets) {
             t->call_noreply<shutdown_rpc_t::finish_shutdown>();
         }
     }
 }
 
+bool shutdown_t::quiescent() const {
+    uint64_t created;
+    uint64_t retired;
+    sum_shards(&created, &retired);
+    if (created != retired) {
+        return false;
+    }
+
+    uint64_t created_again;
+    uint64_t retired_again;
+    sum_shards(&created_again, &retired_again);
+    return created_again == created && retired_again == retired;
+}
+
+void shutdown_t::sum_shards(uint64_t *created, uint64_t *retired) const {
+    *created = 0;
+    *retired = 0;
+    for (size_t i = 0; i <= m_targets.size(); ++i) {
+        *retired += m_shards[i].m_retired.load();
+        *created += m_shards[i].m_created.load();
+    }
+}
+
 } // namespace indecorous
@@ -4,23 +4,82 @@
 #include <atomic>
 #include <cstdint>
 #include <cstddef>
+#include <memory>
 #include <vector>
 
+#include "common.hpp"
+
 namespace indecorous {
 
 class target_t;
 
+// One thread's share of the work tracked by a shutdown_t.  Both counters only
+// ever grow and are only written by the owning thread, so noting work never
+// writes to memory shared with other threads.  Shards are padded so that no
+// two share a cache line.
+class shutdown_shard_t {
+public:
+    shutdown_shard_t();
+
+    // Work must be noted as created before anything can see it, e.g. before an
+    // RPC is written to the target's stream
+    void note_created(uint64_t count) {
+        m_created.store(m_created.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Retiring late is fine, retiring early is not
+    void note_retired(uint64_t count) {
+        m_retired.store(m_retired.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+private:
+    friend class shutdown_t;
+    static const size_t s_cache_line_size = 64;
+
+    std::atomic<uint64_t> m_created;
+    std::atomic<uint64_t> m_retired;
+    char m_padding[2 * s_cache_line_size - 2 * sizeof(std::atomic<uint64_t>)];
+
+    DISABLE_COPYING(shutdown_shard_t);
+};
+
+// Finishes shutdown once begin_shutdown() has been called and every coroutine,
+// task and local RPC has been retired.  This is checked with two passes over
+// the shards: since the counters only grow, two passes with the same totals
+// mean no counter changed in between, so those totals were all true at the
+// same moment, and no work was left if they match.  Work can only be created
+// by other work, so this is exact.  Only threads that retire work after
+// begin_shutdown() run the check.
 class shutdown_t {
 public:
-    shutdown_t(std::vector<target_t *> targets);
+    explicit shutdown_t(std::vector<target_t *> targets);
+
+    // The shard for the thread behind one of `targets`
+    shutdown_shard_t *shard(target_t *target);
 
+    // Only called while no threads are running
     void reset(size_t initial_tasks);
     void begin_shutdown();
-    void update(int64_t active_delta);
+
+    // Called by a thread after noting retired work in its shard, this fences
+    // that write against the scan of the other shards
+    void check_done();
+
 private:
+    // Both passes over the shards agree, and no work is left
+    bool quiescent() const;
+    void sum_shards(uint64_t *created, uint64_t *retired) const;
+
     const std::vector<target_t *> m_targets;
+
+    // One per target, and the last for work noted from outside the threads
+    std::unique_ptr<shutdown_shard_t[]> m_shards;
+    shutdown_shard_t *m_external_shard;
+
+    std::atomic<bool> m_shutting_down;
     std::atomic<bool> m_finish_sent;
-    std::atomic<uint64_t> m_active_count;
+
+    DISABLE_COPYING(shutdown_t);
 };
 
 } // namespace indecorous
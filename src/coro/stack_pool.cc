@@ -0,0 +1,108 @@
+#include "coro/stack_pool.hpp"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "coro/topology.hpp"
+
+namespace indecorous {
+
+const size_t stack_pool_t::s_max_pooled = 1024;
+
+stack_pool_t::node_pool_t::node_pool_t() :
+        mutex(),
+        stacks() { }
+
+stack_pool_t *stack_pool_t::instance() {
+    static stack_pool_t pool;
+    return &pool;
+}
+
+stack_pool_t::stack_pool_t() :
+        m_num_nodes(cpu_topology_t::instance()->num_nodes()),
+        m_nodes(new node_pool_t[m_num_nodes]),
+        m_hits(0),
+        m_misses(0),
+        m_maps(0),
+        m_unmaps(0) { }
+
+stack_pool_t::~stack_pool_t() {
+    for (size_t i = 0; i < m_num_nodes; ++i) {
+        for (auto &stacks : m_nodes[i].stacks) {
+            stacks.clear([] (coro_t *c) { delete c; });
+        }
+    }
+}
+
+size_t stack_pool_t::current_node() const {
+    if (m_num_nodes == 1) {
+        return 0;
+    }
+
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0 || node >= m_num_nodes) {
+        return 0;
+    }
+    return node;
+}
+
+size_t stack_pool_t::take(stack_class_t stack_class, size_t count, intrusive_list_t<coro_t> *out) {
+    size_t res = 0;
+    {
+        node_pool_t *pool = &m_nodes[current_node()];
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        intrusive_list_t<coro_t> &stacks = pool->stacks[static_cast<size_t>(stack_class)];
+        for (; res < count && !stacks.empty(); ++res) {
+            out->push_back(stacks.pop_front());
+        }
+    }
+
+    (res == 0 ? m_misses : m_hits).fetch_add(1, std::memory_order_relaxed);
+    return res;
+}
+
+void stack_pool_t::give(stack_class_t stack_class, intrusive_list_t<coro_t> *in) {
+    node_pool_t *pool = &m_nodes[current_node()];
+    intrusive_list_t<coro_t> &stacks = pool->stacks[static_cast<size_t>(stack_class)];
+    size_t room;
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        room = s_max_pooled - std::min(stacks.size(), s_max_pooled);
+    }
+
+    // Committed pages may never have been touched - fault them in here rather than
+    // in whichever coroutine next runs on the stack
+    intrusive_list_t<coro_t> kept;
+    while (kept.size() < room && !in->empty()) {
+        coro_t *coro = in->pop_front();
+        coro->prefault_stack();
+        kept.push_back(coro);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        while (stacks.size() < s_max_pooled && !kept.empty()) {
+            stacks.push_back(kept.pop_front());
+        }
+    }
+
+    // Unmap the rest outside the lock
+    kept.clear([] (coro_t *c) { delete c; });
+    in->clear([] (coro_t *c) { delete c; });
+}
+
+double stack_pool_t::stats_t::hit_rate() const {
+    uint64_t total = hits + misses;
+    return (total == 0) ? 0.0 : static_cast<double>(hits) / total;
+}
+
+stack_pool_t::stats_t stack_pool_t::stats() const {
+    return { m_hits.load(std::memory_order_relaxed),
+             m_misses.load(std::memory_order_relaxed),
+             m_maps.load(std::memory_order_relaxed),
+             m_unmaps.load(std::memory_order_relaxed) };
+}
+
+} // namespace indecorous
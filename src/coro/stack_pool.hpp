@@ -0,0 +1,77 @@
+#ifndef CORO_STACK_POOL_HPP_
+#define CORO_STACK_POOL_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "common.hpp"
+#include "containers/intrusive.hpp"
+#include "coro/coro.hpp"
+
+namespace indecorous {
+
+// Process-wide second level behind each thread's coro_cache_t.  A cache that
+// runs dry takes a batch of idle coroutines - and so their already-faulted
+// stacks - from here, and a full cache spills a batch back, rather than
+// mapping and unmapping stacks as load moves between threads.  There is one
+// pool per NUMA node, picked by the node the calling thread is running on.
+// Compact stacks are not pooled, they belong to their thread.
+class stack_pool_t {
+public:
+    static stack_pool_t *instance();
+
+    // Moves up to `count` idle coroutines into `out`, returns how many were moved
+    size_t take(stack_class_t stack_class, size_t count, intrusive_list_t<coro_t> *out);
+
+    // Takes the idle coroutines in `in`, faulting in their committed stacks, and
+    // deletes any beyond the pool's capacity
+    void give(stack_class_t stack_class, intrusive_list_t<coro_t> *in);
+
+    struct stats_t {
+        uint64_t hits; // take() calls that got at least one coroutine
+        uint64_t misses;
+        uint64_t maps; // Stack mappings made and removed, pooled or not
+        uint64_t unmaps;
+
+        double hit_rate() const;
+    };
+    stats_t stats() const;
+
+    size_t num_nodes() const { return m_num_nodes; }
+
+private:
+    friend class coro_t;
+    friend class compact_stack_pool_t;
+    void note_map() { m_maps.fetch_add(1, std::memory_order_relaxed); }
+    void note_unmap() { m_unmaps.fetch_add(1, std::memory_order_relaxed); }
+
+    stack_pool_t();
+    ~stack_pool_t();
+
+    size_t current_node() const;
+
+    struct node_pool_t {
+        node_pool_t();
+        std::mutex mutex;
+        intrusive_list_t<coro_t> stacks[num_stack_classes];
+    };
+
+    static const size_t s_max_pooled; // Per stack class and node
+
+    const size_t m_num_nodes;
+    std::unique_ptr<node_pool_t[]> m_nodes;
+
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+    std::atomic<uint64_t> m_maps;
+    std::atomic<uint64_t> m_unmaps;
+
+    DISABLE_COPYING(stack_pool_t);
+};
+
+} // namespace indecorous
+
+#endif // CORO_STACK_POOL_HPP_
@@ -0,0 +1,51 @@
+#include "coro/stats.hpp"
+
+#include <algorithm>
+
+#include "coro/coro.hpp"
+
+namespace indecorous {
+
+coro_stats_t::coro_stats_t() :
+        run_ns(0),
+        wait_ns() { }
+
+coro_stats_t &coro_stats_t::operator += (const coro_stats_t &other) {
+    run_ns += other.run_ns;
+    for (size_t i = 0; i < num_wait_categories; ++i) {
+        wait_ns[i] += other.wait_ns[i];
+    }
+    return *this;
+}
+
+stack_histogram_t::stack_histogram_t() :
+        samples(0),
+        max_depth(0),
+        buckets() { }
+
+void stack_histogram_t::add(size_t depth) {
+    size_t bucket = 0;
+    while (bucket + 1 < num_buckets && depth >= bucket_min(bucket + 1)) {
+        ++bucket;
+    }
+    ++buckets[bucket];
+    ++samples;
+    max_depth = std::max(max_depth, depth);
+}
+
+#if INDECOROUS_CORO_STATS
+wait_category_scope_t::wait_category_scope_t(wait_category_t category) :
+        m_coro(coro_t::self()),
+        m_prev_scoped(m_coro->m_category_scoped),
+        m_prev_category(m_coro->m_scope_category) {
+    m_coro->m_category_scoped = true;
+    m_coro->m_scope_category = category;
+}
+
+wait_category_scope_t::~wait_category_scope_t() {
+    m_coro->m_category_scoped = m_prev_scoped;
+    m_coro->m_scope_category = m_prev_category;
+}
+#endif
+
+} // namespace indecorous
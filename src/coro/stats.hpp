@@ -0,0 +1,76 @@
+#ifndef CORO_STATS_HPP_
+#define CORO_STATS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common.hpp"
+#include "sync/wait_object.hpp"
+
+// Stack depth measurement is only compiled in when this is set, e.g. with
+// `make STACK_STATS=1`.  Stacks are filled with a canary pattern, which is
+// scanned for the deepest overwritten byte when a coroutine is released.
+#ifndef INDECOROUS_STACK_STATS
+    #define INDECOROUS_STACK_STATS 0
+#endif
+
+namespace indecorous {
+
+class coro_t;
+
+// Time a coroutine spent running, and blocked by category of what it waited on
+struct coro_stats_t {
+    coro_stats_t();
+    coro_stats_t &operator += (const coro_stats_t &other);
+
+    uint64_t run_ns;
+    uint64_t wait_ns[num_wait_categories];
+};
+
+// Deepest stack use of coroutines in power-of-two buckets: bucket `i` counts
+// depths in [2^(i+10), 2^(i+11)) bytes, with shallower stacks in the first bucket
+// and deeper ones in the last.
+struct stack_histogram_t {
+    static const size_t num_buckets = 14;
+
+    stack_histogram_t();
+    void add(size_t depth);
+    static size_t bucket_min(size_t bucket) { return bucket == 0 ? 0 : size_t(1) << (bucket + 10); }
+
+    uint64_t samples;
+    size_t max_depth;
+    uint64_t buckets[num_buckets];
+};
+
+// Names the spawn site of a coroutine by the type of the spawned callable, which
+// is unique per lambda expression.  The result is a static string.
+template <typename Callable>
+const char *spawn_site_name() {
+    return __PRETTY_FUNCTION__;
+}
+
+// Attributes any blocking of the current coroutine within this scope to the
+// given category, regardless of the waitable_t - e.g. waiting on an RPC reply
+// through a future_t.  Does nothing unless INDECOROUS_CORO_STATS is set.
+class wait_category_scope_t {
+public:
+#if INDECOROUS_CORO_STATS
+    explicit wait_category_scope_t(wait_category_t category);
+    ~wait_category_scope_t();
+
+private:
+    coro_t *m_coro;
+    bool m_prev_scoped;
+    wait_category_t m_prev_category;
+#else
+    explicit wait_category_scope_t(wait_category_t) { }
+
+private:
+#endif
+
+    DISABLE_COPYING(wait_category_scope_t);
+};
+
+} // namespace indecorous
+
+#endif // CORO_STATS_HPP_
@@ -0,0 +1,54 @@
+#include "coro/task.hpp"
+
+#if INDECOROUS_TASKS
+
+#include "coro/thread.hpp"
+
+namespace indecorous {
+
+task_wait_t::task_wait_t(waitable_t *waitable) :
+        m_waitable(waitable),
+        m_task(nullptr),
+        m_result(wait_result_t::Success),
+        m_suspending(false),
+        m_done(false) { }
+
+task_wait_t::~task_wait_t() {
+    // Only if the suspended task's frame is destroyed
+    if (in_a_list()) {
+        m_waitable->remove_wait(this);
+    }
+}
+
+void task_wait_t::wait_done(wait_result_t result) {
+    m_result = result;
+    m_done = true;
+    if (!m_suspending) {
+        thread_t::self()->dispatcher()->enqueue_task(m_task);
+    }
+}
+
+void task_wait_t::object_moved(waitable_t *new_ptr) {
+    m_waitable = new_ptr;
+}
+
+task_driver_t::promise_type::promise_type() :
+        m_dispatch(thread_t::self()->dispatcher()) {
+    m_dispatch->note_new_task();
+}
+
+task_driver_t::promise_type::~promise_type() {
+    m_dispatch->note_finished_task();
+}
+
+void task_driver_t::promise_type::resume() {
+    std::coroutine_handle<promise_type>::from_promise(*this).resume();
+}
+
+void task_driver_t::start() {
+    m_promise->m_dispatch->enqueue_task(m_promise);
+}
+
+} // namespace indecorous
+
+#endif // INDECOROUS_TASKS
@@ -0,0 +1,294 @@
+#ifndef CORO_TASK_HPP_
+#define CORO_TASK_HPP_
+
+// Build with TASKS=1, see the Makefile
+#ifndef INDECOROUS_TASKS
+    #define INDECOROUS_TASKS 0
+#endif
+
+#if INDECOROUS_TASKS
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "common.hpp"
+#include "coro/coro.hpp"
+#include "sync/promise.hpp"
+#include "sync/wait_object.hpp"
+
+namespace indecorous {
+
+// Stackless coroutines for short handlers that do not need the stack of a
+// coro_t, e.g. for high-fanout work with little state:
+//   task_t<int> add_after(event_t *event, int a, int b) {
+//       co_await *event;
+//       co_return a + b;
+//   }
+//   future_t<int> sum = spawn_task(add_after(&event, 1, 2));
+//
+// A task_t does nothing until it is spawned or awaited by another task.  Tasks
+// may co_await other tasks and any waitable_t, which throws on failure as
+// waitable_t::wait() does.  A suspended task is resumed from the main context of
+// its thread's dispatcher_t, between runs of coroutines.  Tasks have no coro_t,
+// so they must not call anything that blocks or spawns a coroutine, and their
+// waits are not interruptible.
+template <typename T> class task_t;
+
+class task_promise_base_t : public resumable_t {
+public:
+    task_promise_base_t() : m_continuation(), m_exception() { }
+
+    std::suspend_always initial_suspend() noexcept { return { }; }
+
+    // Continues the awaiting task, if any, without going through the dispatcher_t
+    struct final_awaiter_t {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+            std::coroutine_handle<> next = self.promise().m_continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept { }
+    };
+    final_awaiter_t final_suspend() noexcept { return { }; }
+
+    void unhandled_exception() { m_exception = std::current_exception(); }
+
+protected:
+    template <typename T> friend class task_t;
+
+    std::coroutine_handle<> m_continuation;
+    std::exception_ptr m_exception;
+
+    DISABLE_COPYING(task_promise_base_t);
+};
+
+template <typename T>
+class task_promise_t final : public task_promise_base_t {
+public:
+    task_promise_t() : m_value() { }
+
+    task_t<T> get_return_object() {
+        return task_t<T>(std::coroutine_handle<task_promise_t>::from_promise(*this));
+    }
+
+    template <typename U>
+    void return_value(U &&value) { m_value.emplace(std::forward<U>(value)); }
+
+    T result() {
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+        return std::move(*m_value);
+    }
+
+    void resume() override final {
+        std::coroutine_handle<task_promise_t>::from_promise(*this).resume();
+    }
+
+private:
+    std::optional<T> m_value;
+};
+
+template <>
+class task_promise_t<void> final : public task_promise_base_t {
+public:
+    task_promise_t() = default;
+
+    task_t<void> get_return_object();
+
+    void return_void() { }
+
+    void result() {
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+    void resume() override final {
+        std::coroutine_handle<task_promise_t>::from_promise(*this).resume();
+    }
+};
+
+template <typename T>
+class task_t {
+public:
+    typedef task_promise_t<T> promise_type;
+
+    task_t(task_t &&other) : m_handle(std::exchange(other.m_handle, nullptr)) { }
+    ~task_t() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    // Awaiting a task runs it, and continues the awaiting task when it returns
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+        m_handle.promise().m_continuation = awaiting;
+        return m_handle;
+    }
+    T await_resume() { return m_handle.promise().result(); }
+
+private:
+    friend class task_promise_t<T>;
+    explicit task_t(std::coroutine_handle<promise_type> handle) : m_handle(handle) { }
+
+    std::coroutine_handle<promise_type> m_handle;
+
+    DISABLE_COPYING(task_t);
+};
+
+inline task_t<void> task_promise_t<void>::get_return_object() {
+    return task_t<void>(std::coroutine_handle<task_promise_t>::from_promise(*this));
+}
+
+// Suspends a task until a waitable_t is done, see operator co_await below
+class task_wait_t final : public wait_callback_t {
+public:
+    explicit task_wait_t(waitable_t *waitable);
+    ~task_wait_t();
+
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> task) {
+        static_assert(std::is_base_of<task_promise_base_t, Promise>::value,
+                      "a waitable_t may only be awaited in a task_t");
+        m_task = &task.promise();
+        m_suspending = true;
+        m_waitable->add_wait(this);
+        m_suspending = false;
+        // Carry on without a trip through the dispatcher_t if it was already done
+        return !m_done;
+    }
+    void await_resume() const { check_wait_result(m_result); }
+
+private:
+    void wait_done(wait_result_t result) override final;
+    void object_moved(waitable_t *new_ptr) override final;
+
+    waitable_t *m_waitable;
+    resumable_t *m_task;
+    wait_result_t m_result;
+    bool m_suspending; // Set during add_wait(), which may call wait_done() directly
+    bool m_done;
+
+    DISABLE_COPYING(task_wait_t);
+};
+
+inline task_wait_t operator co_await(waitable_t &waitable) {
+    return task_wait_t(&waitable);
+}
+
+inline task_wait_t operator co_await(waitable_t &&waitable) {
+    return task_wait_t(&waitable);
+}
+
+// Awaiting a future_t gives its value, which get() cannot do in a task
+template <typename T>
+class task_future_wait_t {
+public:
+    explicit task_future_wait_t(future_t<T> *future) : m_future(future), m_wait(future) { }
+
+    bool await_ready() const { return m_future->has(); }
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> task) { return m_wait.await_suspend(task); }
+    decltype(auto) await_resume() {
+        m_wait.await_resume();
+        if constexpr (!std::is_void<T>::value) {
+            return m_future->m_data->cref();
+        }
+    }
+
+private:
+    future_t<T> *m_future;
+    task_wait_t m_wait;
+
+    DISABLE_COPYING(task_future_wait_t);
+};
+
+template <typename T>
+task_future_wait_t<T> operator co_await(future_t<T> &future) {
+    return task_future_wait_t<T>(&future);
+}
+
+template <typename T>
+task_future_wait_t<T> operator co_await(future_t<T> &&future) {
+    return task_future_wait_t<T>(&future);
+}
+
+// The outermost frame of a spawned task, which frees itself once the task returns
+class task_driver_t {
+public:
+    class promise_type final : public resumable_t {
+    public:
+        promise_type();
+        ~promise_type();
+
+        task_driver_t get_return_object() { return task_driver_t(this); }
+        std::suspend_always initial_suspend() noexcept { return { }; }
+        std::suspend_never final_suspend() noexcept { return { }; }
+        void return_void() { }
+
+        // As with coroutines, exceptions must not escape a spawned task
+        [[noreturn]] void unhandled_exception() { std::terminate(); }
+
+        void resume() override final;
+
+    private:
+        friend class task_driver_t;
+        dispatcher_t *m_dispatch;
+
+        DISABLE_COPYING(promise_type);
+    };
+
+    // Queues the task to run on the current thread
+    void start();
+
+private:
+    explicit task_driver_t(promise_type *promise) : m_promise(promise) { }
+    promise_type *m_promise;
+};
+
+template <typename T, typename Result>
+task_driver_t drive_task(task_t<T> task, Result result) {
+    if constexpr (std::is_void<T>::value) {
+        co_await task;
+        result.fulfill();
+    } else {
+        result.fulfill(co_await task);
+    }
+}
+
+// Stand-in for a promise_t when nobody is interested in the result
+struct detached_task_result_t {
+    template <typename U>
+    void fulfill(U &&) { }
+    void fulfill() { }
+};
+
+// Runs `task` on this thread once the current coroutine or task next blocks,
+// the future is fulfilled with its result.  May be called from a coroutine or
+// from another task.
+template <typename T>
+future_t<T> spawn_task(task_t<T> &&task) {
+    promise_t<T> promise;
+    future_t<T> res = promise.get_future();
+    drive_task(std::move(task), std::move(promise)).start();
+    return res;
+}
+
+template <typename T>
+void spawn_task_detached(task_t<T> &&task) {
+    drive_task(std::move(task), detached_task_result_t()).start();
+}
+
+} // namespace indecorous
+
+#endif // INDECOROUS_TASKS
+
+#endif // CORO_TASK_HPP_
@@ -7,9 +7,11 @@
 
 #include "coro/barrier.hpp"
 #include "coro/coro.hpp"
+#include "coro/cycle_clock.hpp"
 #include "coro/sched.hpp"
 #include "coro/shutdown.hpp"
 #include "errors.hpp"
+#include "sync/file_wait.hpp"
 #include "sync/interruptor.hpp"
 
 namespace indecorous {
@@ -18,26 +20,78 @@ thread_local thread_t* thread_t::s_instance = nullptr;
 
 thread_t::thread_t(scheduler_t *parent,
                    target_t *io_target,
+                   thread_topology_t topology,
                    std::function<void()> inner_main,
                    std::function<void()> coro_pull) :
         m_parent(parent),
+        m_io_target(io_target),
+        m_topology(std::move(topology)),
         m_direct_stream(),
-        m_direct_target(&m_direct_stream),
-        m_hub(&m_direct_target, io_target),
+        m_direct_target(),
+        m_hub(),
         m_events(),
+        m_stall_state(),
+        m_busy_poll(),
         m_dispatcher(nullptr),
         m_shutdown_event(),
         m_stop_immediately(false),
+        m_num_active(0),
+        m_run_ns_average(0),
+        m_parked(false),
         m_inner_main(std::move(inner_main)),
         m_coro_pull(std::move(coro_pull)),
-        m_thread(&thread_t::main, this) { }
+        m_started(2),
+        m_thread(&thread_t::main, this) {
+    m_started.wait(); // Wait for the thread to allocate its members
+}
 
 shared_registry_t *thread_t::get_shared_registry() {
     return &m_parent->m_shared_registry;
 }
 
+void thread_t::poll_events(bool wait) {
+    uint64_t start = cycle_clock_t::now();
+    m_events->check(wait);
+    m_dispatcher->note_poll(cycle_clock_t::now() - start);
+}
+
+void thread_t::run_dispatcher() {
+    uint64_t start = cycle_clock_t::now();
+    m_dispatcher->run();
+    uint64_t run_ns = cycle_clock_t::to_ns(cycle_clock_t::now() - start);
+
+    // Weighs the last eight or so runs
+    m_run_ns_average = m_run_ns_average - (m_run_ns_average / 8) + (run_ns / 8);
+    m_direct_stream->publish_load(m_dispatcher->runnable(), m_run_ns_average);
+}
+
+bool thread_t::spin_events(uint64_t deadline) {
+    // epoll_wait is still a system call, so in between the regular checks for
+    // other events only the queue is watched
+    const uint64_t check_interval = cycle_clock_t::from_ns(10 * 1000);
+
+    uint64_t start = cycle_clock_t::now();
+    uint64_t now = start;
+    uint64_t next_check = start;
+    bool ready = false;
+    while (!ready && now < deadline) {
+        if (now >= next_check || m_direct_stream->has_pending()) {
+            m_events->check(false);
+            ready = !m_dispatcher->idle();
+            next_check = now + check_interval;
+        } else {
+#if INDECOROUS_HAS_TSC
+            _mm_pause();
+#endif
+        }
+        now = cycle_clock_t::now();
+    }
+    m_dispatcher->note_poll(now - start);
+    return ready;
+}
+
 void thread_t::note_local_rpc() {
-    m_parent->m_shutdown->update(1);
+    m_dispatcher->note_new_task();
 }
 
 void thread_t::begin_shutdown() {
@@ -53,31 +107,66 @@ void thread_t::join() {
     m_thread.join();
 }
 
+void thread_t::add_steal_peer(thread_t *peer) {
+    m_direct_stream->add_peer(peer->m_direct_stream.get());
+}
+
+void thread_t::wake() {
+    m_direct_stream->wake();
+}
+
+void thread_t::update_pool() {
+    size_t num_active = m_parent->m_num_active.load(std::memory_order_acquire);
+    if (num_active != m_num_active) {
+        m_num_active = num_active;
+        bool parked = !m_hub->set_num_active(num_active);
+        if (parked != m_parked) {
+            logDebug("%s", parked ? "Parking" : "Unparking");
+            m_parked = parked;
+        }
+    }
+}
+
 // This should be instantiated at the beginning of a system coroutine
 // (aside from the initial coroutine, which is implicitly handled) to
-// counteract coroutine delta tracking so that it doesn't count against
-// shutdown.
+// retire it early so that it doesn't count against shutdown.
 class ignore_coro_for_shutdown_t {
 public:
     ignore_coro_for_shutdown_t() {
-        thread_t::self()->dispatcher()->m_coro_delta -= 1;
+        thread_t::self()->dispatcher()->m_retired += 1;
     }
     ~ignore_coro_for_shutdown_t() {
-        thread_t::self()->dispatcher()->m_coro_delta += 1;
+        // Balances out the release of the coroutine
+        thread_t::self()->dispatcher()->note_new_task();
     }
 };
 
 void thread_t::main() {
+    // Before anything else is set up, so that the thread's queues, events and
+    // coroutine stacks are first touched - and so allocated - on its NUMA node
+    apply_thread_topology(m_topology);
+    m_direct_stream = std::make_unique<local_stream_t>();
+    m_direct_target = std::make_unique<local_target_t<local_stream_t> >(m_direct_stream.get(),
+                                                                        m_topology);
+    m_hub = std::make_unique<message_hub_t>(m_direct_target.get(), m_io_target);
+    m_events = std::make_unique<events_t>();
     s_instance = this;
     logDebug("Starting");
+    m_started.wait();
 
     m_parent->m_barrier.wait(); // Barrier for the scheduler_t constructor, thread ready
     m_parent->m_barrier.wait(); // Wait for run or ~scheduler_t
 
     m_stop_immediately = false;
+
+    // The stream is waited on every time the thread runs out of work
+    file_registration_t stream_registration(m_direct_stream->fd());
+
     event_t close_event;
     m_dispatcher = std::make_unique<dispatcher_t>(
         m_parent->m_shutdown.get(),
+        m_parent->m_shutdown->shard(m_direct_target.get()),
+        &m_stall_state,
         [&] {
             try {
                 interruptor_t shutdown(&close_event);
@@ -90,12 +179,49 @@ void thread_t::main() {
                     }
                 });
 
+                // Stealable tasks are deferred while there are other coroutines to
+                // run so that idle peers can take them in the meantime - but not
+                // indefinitely, in case those coroutines are waiting on them
+                const size_t max_deferrals = 16;
+                size_t deferrals = 0;
+                bool stealing = false;
+                auto next_message = [&] () {
+                    read_message_t msg = m_direct_stream->read();
+                    if (msg.buffer.has()) {
+                        return msg;
+                    }
+
+                    bool idle = m_dispatcher->idle();
+                    if (idle || deferrals >= max_deferrals) {
+                        deferrals = 0;
+                        read_message_t own_msg = m_direct_stream->steal();
+                        if (own_msg.buffer.has()) {
+                            return own_msg;
+                        }
+                    }
+
+                    // Parked threads only finish what was sent to them directly,
+                    // their peers take any stealable messages
+                    if (!idle || m_parked) {
+                        return read_message_t::empty();
+                    }
+
+                    read_message_t peer_msg = m_direct_stream->steal_from_peers();
+                    stealing = peer_msg.buffer.has();
+                    return peer_msg;
+                };
+
                 while (true) {
-                    read_message_t msg = m_direct_stream.read();
+                    read_message_t msg = next_message();
                     if (msg.buffer.has()) {
-                        m_hub.spawn_task(std::move(msg));
+                        m_hub->spawn_task(std::move(msg));
+                    } else if (stealing || m_direct_stream->has_stealable()) {
+                        // Nobody will notify us about these, check back after the
+                        // currently-runnable coroutines
+                        ++deferrals;
+                        coro_t::yield();
                     } else {
-                        m_direct_stream.wait();
+                        m_direct_stream->wait();
                     }
                 }
             } catch (wait_interrupted_exc_t &) {
@@ -119,29 +245,53 @@ void thread_t::main() {
 
     logDebug("Exiting");
     close_event.set();
-    m_dispatcher->run();
+    do {
+        // A loop may end with coroutines still queued once its time is up
+        m_dispatcher->run();
+    } while (!m_dispatcher->idle());
     m_dispatcher.reset();
 
     m_parent->m_barrier.wait(); // Barrier for ~scheduler_t, safe to destruct
     s_instance = nullptr;
 }
 
-coro_thread_t::coro_thread_t(scheduler_t *parent, target_t *io_target) :
-    m_thread(parent, io_target,
+coro_thread_t::coro_thread_t(scheduler_t *parent, target_t *io_target,
+                             thread_topology_t topology) :
+    m_thread(parent, io_target, std::move(topology),
              std::bind(&coro_thread_t::inner_main, this),
              [] { }) { }
 
 void coro_thread_t::inner_main() {
-    m_thread.events()->check(m_thread.dispatcher()->m_run_queue.empty());
-    m_thread.dispatcher()->run();
+    if (!m_thread.dispatcher()->idle()) {
+        m_thread.poll_events(false);
+    } else if (m_thread.parked()) {
+        // Parked threads should not use up CPU, or be woken up to steal
+        m_thread.poll_events(true);
+    } else {
+        m_thread.set_idle(true);
+        busy_poll_t *busy_poll = &m_thread.m_busy_poll;
+        uint64_t budget = busy_poll->budget();
+        uint64_t start = cycle_clock_t::now();
+        if (budget != 0 && m_thread.spin_events(start + budget)) {
+            busy_poll->note_hit(cycle_clock_t::now() - start);
+        } else {
+            uint64_t block_start = cycle_clock_t::now();
+            m_thread.poll_events(true);
+            busy_poll->note_block(block_start - start, cycle_clock_t::now() - block_start);
+        }
+        m_thread.set_idle(false);
+    }
+    m_thread.update_pool();
+    m_thread.run_dispatcher();
 }
 
 io_thread_t::io_thread_t(scheduler_t *parent,
                          target_t *io_target,
-                         io_stream_t *io_stream) :
+                         io_stream_t *io_stream,
+                         thread_topology_t topology) :
     m_io_stream(io_stream),
     m_ready_for_next(),
-    m_thread(parent, io_target,
+    m_thread(parent, io_target, std::move(topology),
              std::bind(&io_thread_t::inner_main, this),
              std::bind(&io_thread_t::coro_pull, this)) { }
 
@@ -156,10 +306,12 @@ void io_thread_t::coro_pull() {
 
 void io_thread_t::inner_main() {
     m_ready_for_next.set();
-    m_thread.events()->check(m_thread.dispatcher()->m_run_queue.empty());
+    m_thread.poll_events(m_thread.dispatcher()->idle());
+    m_thread.update_pool();
     m_thread.dispatcher()->run();
     while (m_thread.dispatcher()->m_coro_cache.extant() > 2) {
-        m_thread.events()->check(m_thread.dispatcher()->m_run_queue.empty());
+        m_thread.poll_events(m_thread.dispatcher()->idle());
+        m_thread.update_pool();
         m_thread.dispatcher()->run();
     }
 }
@@ -7,7 +7,11 @@
 
 #include "common.hpp"
 #include "containers/intrusive.hpp"
+#include "coro/barrier.hpp"
+#include "coro/busy_poll.hpp"
 #include "coro/events.hpp"
+#include "coro/topology.hpp"
+#include "coro/watchdog.hpp"
 #include "rpc/hub.hpp"
 #include "sync/event.hpp"
 
@@ -21,6 +25,7 @@ class thread_t {
 public:
     thread_t(scheduler_t *parent,
              target_t *io_target,
+             thread_topology_t topology,
              std::function<void()> inner_main,
              std::function<void()> coro_pull);
 
@@ -28,22 +33,59 @@ public:
 
     void join();
 
-    target_t *target() { return &m_direct_target; }
-    message_hub_t *hub() { return &m_hub; }
-    events_t *events() { return &m_events; }
+    target_t *target() { return m_direct_target.get(); }
+    message_hub_t *hub() { return m_hub.get(); }
+    events_t *events() { return m_events.get(); }
     dispatcher_t *dispatcher() { return m_dispatcher.get(); }
     event_t *shutdown_event() { return &m_shutdown_event; }
+    stall_state_t *stall_state() { return &m_stall_state; }
+    const busy_poll_t *busy_poll() const { return &m_busy_poll; }
 
-    size_t queue_length() const { return m_direct_stream.size(); }
+    size_t queue_length() const { return m_direct_stream->size(); }
+
+    // Parked threads are not among the hubs' local_targets(), and finish the work
+    // already sent to them without stealing more, see scheduler_t::resize()
+    bool parked() const { return m_parked; }
+
+    // Idle threads have nothing to run, and are woken up to steal tasks when a
+    // peer receives stealable RPCs
+    void set_idle(bool idle) { m_direct_stream->set_idle(idle); }
+
+    // Checks for events, accounting the time spent to the dispatcher's loop stats
+    void poll_events(bool wait);
+
+    // Runs the dispatcher, then publishes the thread's load for call_any routing
+    void run_dispatcher();
+
+    // Keeps checking the queue and polling for events without blocking until
+    // the dispatcher has something to run or cycle_clock_t time `deadline`.
+    // Returns whether there is something to run.
+    bool spin_events(uint64_t deadline);
 
 protected:
     void main();
 
+    // For linking the coro threads together for work-stealing
+    friend class scheduler_t;
+    void add_steal_peer(thread_t *peer);
+    void wake();
+
+    // Catches up with the scheduler_t's number of active coro threads, called
+    // from the thread's loop before each run of the dispatcher_t
+    friend class io_thread_t;
+    void update_pool();
+
     // For initiating and completing stop of a thread
     friend class shutdown_rpc_t;
     void begin_shutdown();
     void finish_shutdown();
 
+    // For signalling a stalled thread
+    friend class stall_watchdog_t;
+
+    // For adapting the spin phase of the idle loop
+    friend class coro_thread_t;
+
     // For immediately noting a local RPC
     friend class target_t;
     void note_local_rpc();
@@ -54,17 +96,27 @@ protected:
 
     scheduler_t * const m_parent;
 
-    local_stream_t m_direct_stream;
-    local_target_t<local_stream_t> m_direct_target;
-
-    message_hub_t m_hub;
-    events_t m_events;
+    target_t * const m_io_target;
+    const thread_topology_t m_topology;
+
+    // Allocated by the thread itself once it is pinned, so that they are first
+    // touched on its NUMA node.  The constructor waits until they exist.
+    std::unique_ptr<local_stream_t> m_direct_stream;
+    std::unique_ptr<local_target_t<local_stream_t> > m_direct_target;
+    std::unique_ptr<message_hub_t> m_hub;
+    std::unique_ptr<events_t> m_events;
+    stall_state_t m_stall_state;
+    busy_poll_t m_busy_poll;
     std::unique_ptr<dispatcher_t> m_dispatcher;
 
     event_t m_shutdown_event;
     bool m_stop_immediately;
+    size_t m_num_active; // As last seen by update_pool(), 0 before the first call
+    uint64_t m_run_ns_average;
+    bool m_parked;
     std::function<void()> m_inner_main;
     std::function<void()> m_coro_pull;
+    thread_barrier_t m_started;
     std::thread m_thread;
 
     thread_local static thread_t *s_instance;
@@ -75,7 +127,8 @@ protected:
 class coro_thread_t {
 public:
     coro_thread_t(scheduler_t *parent,
-                  target_t *io_target);
+                  target_t *io_target,
+                  thread_topology_t topology);
 
     thread_t *thread() { return &m_thread; }
 
@@ -91,7 +144,8 @@ class io_thread_t {
 public:
     io_thread_t(scheduler_t *parent,
                 target_t *io_target,
-                io_stream_t *io_stream);
+                io_stream_t *io_stream,
+                thread_topology_t topology);
 
     thread_t *thread() { return &m_thread; }
 
@@ -0,0 +1,153 @@
+#include "coro/timer_wheel.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "sync/timer.hpp"
+
+namespace indecorous {
+
+timer_wheel_t::timer_wheel_t() :
+        m_slots(),
+        m_occupied(),
+        m_overflow(),
+        m_expired(),
+        m_now_ms(now_ms()),
+        m_size(0) { }
+
+timer_wheel_t::~timer_wheel_t() { }
+
+uint64_t timer_wheel_t::now_ms() {
+    struct timespec t;
+    GUARANTEE_ERR(clock_gettime(CLOCK_MONOTONIC, &t) == 0);
+    return (uint64_t(t.tv_sec) * 1000) + (t.tv_nsec / 1000000);
+}
+
+intrusive_list_t<timer_callback_t> *timer_wheel_t::list_of(uint32_t position) {
+    if (position == s_expired) {
+        return &m_expired;
+    } else if (position == s_overflow) {
+        return &m_overflow;
+    }
+    assert(position < s_expired);
+    return &m_slots[position / s_num_slots][position % s_num_slots];
+}
+
+void timer_wheel_t::add(timer_callback_t *cb) {
+    cb->m_expiry_ms = cb->timeout().ms_rounded_up();
+    place(cb);
+    ++m_size;
+}
+
+void timer_wheel_t::remove(timer_callback_t *cb) {
+    uint32_t position = cb->m_wheel_position;
+    intrusive_list_t<timer_callback_t> *list = list_of(position);
+    list->remove(cb);
+    if (position < s_expired && list->empty()) {
+        m_occupied[position / s_num_slots] &= ~(uint64_t(1) << (position % s_num_slots));
+    }
+    --m_size;
+}
+
+void timer_wheel_t::place(timer_callback_t *cb) {
+    uint64_t expiry = cb->m_expiry_ms;
+    if (expiry <= m_now_ms) {
+        cb->m_wheel_position = s_expired;
+        m_expired.push_back(cb);
+        return;
+    }
+
+    uint64_t remaining = expiry - m_now_ms;
+    for (size_t level = 0; level < s_num_levels; ++level) {
+        if (remaining < level_span(level)) {
+            size_t slot = slot_of(expiry, level);
+            cb->m_wheel_position = (level * s_num_slots) + slot;
+            m_slots[level][slot].push_back(cb);
+            m_occupied[level] |= uint64_t(1) << slot;
+            return;
+        }
+    }
+
+    cb->m_wheel_position = s_overflow;
+    m_overflow.push_back(cb);
+}
+
+void timer_wheel_t::move_all(intrusive_list_t<timer_callback_t> *list) {
+    intrusive_list_t<timer_callback_t> moving;
+    moving.splice_back(list);
+    while (timer_callback_t *cb = moving.pop_front()) {
+        place(cb);
+    }
+}
+
+uint64_t timer_wheel_t::next_event_tick() const {
+    uint64_t res = std::numeric_limits<uint64_t>::max();
+    for (size_t level = 0; level < s_num_levels; ++level) {
+        uint64_t occupied = m_occupied[level];
+        if (occupied == 0) {
+            continue;
+        }
+
+        // Rotate the bitmap so that bit 0 is the slot of the next period
+        size_t shift = s_slot_bits * level;
+        uint64_t period = (m_now_ms >> shift) + 1;
+        size_t first = period & (s_num_slots - 1);
+        uint64_t rotated = (first == 0) ? occupied : ((occupied >> first) | (occupied << (s_num_slots - first)));
+        uint64_t tick = (period + __builtin_ctzll(rotated)) << shift;
+        res = std::min(res, tick);
+    }
+
+    if (!m_overflow.empty()) {
+        size_t shift = s_slot_bits * (s_num_levels - 1);
+        res = std::min(res, ((m_now_ms >> shift) + 1) << shift);
+    }
+    return res;
+}
+
+int64_t timer_wheel_t::next_timeout_ms(uint64_t now) const {
+    if (!m_expired.empty()) {
+        return 0;
+    }
+
+    uint64_t tick = next_event_tick();
+    if (tick == std::numeric_limits<uint64_t>::max()) {
+        return -1;
+    }
+    return (tick <= now) ? 0 : std::min<uint64_t>(tick - now, std::numeric_limits<int64_t>::max());
+}
+
+void timer_wheel_t::advance(uint64_t now) {
+    for (uint64_t tick = next_event_tick(); tick <= now; tick = next_event_tick()) {
+        m_now_ms = tick;
+
+        // From the top down, so timers can move down several levels at once
+        if ((tick & (level_span(s_num_levels - 2) - 1)) == 0) {
+            move_all(&m_overflow);
+        }
+        for (size_t level = s_num_levels - 1; level > 0; --level) {
+            if ((tick & (level_span(level - 1) - 1)) == 0) {
+                size_t slot = slot_of(tick, level);
+                m_occupied[level] &= ~(uint64_t(1) << slot);
+                move_all(&m_slots[level][slot]);
+            }
+        }
+
+        size_t slot = slot_of(tick, 0);
+        m_occupied[0] &= ~(uint64_t(1) << slot);
+        m_slots[0][slot].each([] (timer_callback_t *cb) { cb->m_wheel_position = s_expired; });
+        m_expired.splice_back(&m_slots[0][slot]);
+    }
+    m_now_ms = std::max(m_now_ms, now);
+}
+
+timer_callback_t *timer_wheel_t::pop_expired() {
+    timer_callback_t *cb = m_expired.pop_front();
+    if (cb != nullptr) {
+        --m_size;
+    }
+    return cb;
+}
+
+} // namespace indecorous
@@ -0,0 +1,81 @@
+#ifndef CORO_TIMER_WHEEL_HPP_
+#define CORO_TIMER_WHEEL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common.hpp"
+#include "containers/intrusive.hpp"
+
+namespace indecorous {
+
+class timer_callback_t;
+
+// Hierarchical timing wheel of millisecond ticks, so that starting and stopping
+// a timer takes constant time however many are running.  Level `l` has
+// s_num_slots slots of s_num_slots^l ticks each, and a timer goes in the lowest
+// level that spans its remaining time.  When the wheel reaches a slot above
+// level 0, that slot's timers move down to lower levels (or out of the wheel),
+// so each timer is moved at most once per level.  Timers beyond the top level
+// wait in an overflow list, which is checked every time the top level moves
+// on by one slot.  An occupancy bitmap per level means the wheel can jump
+// straight to the next tick that has something to do.
+class timer_wheel_t {
+public:
+    // Starts at the current time on the monotonic clock
+    timer_wheel_t();
+    ~timer_wheel_t();
+
+    void add(timer_callback_t *cb);
+    void remove(timer_callback_t *cb);
+
+    size_t size() const { return m_size; }
+
+    // Milliseconds until advance() may have something to do, 0 if there are
+    // expired timers, -1 if there are no timers
+    int64_t next_timeout_ms(uint64_t now_ms) const;
+
+    // Moves every timer due by `now_ms` into the expired batch
+    void advance(uint64_t now_ms);
+
+    // Takes the next timer from the expired batch, null if there are none.
+    // Timers added or removed while handling the batch are handled correctly.
+    timer_callback_t *pop_expired();
+
+    // The current time in ticks
+    static uint64_t now_ms();
+
+private:
+    static const size_t s_slot_bits = 6;
+    static const size_t s_num_slots = size_t(1) << s_slot_bits;
+    static const size_t s_num_levels = 5;
+
+    // Where a timer is, stored in the timer_callback_t
+    static const uint32_t s_expired = s_num_levels * s_num_slots;
+    static const uint32_t s_overflow = s_expired + 1;
+
+    static uint64_t level_span(size_t level) { return uint64_t(1) << (s_slot_bits * (level + 1)); }
+    static size_t slot_of(uint64_t tick, size_t level) { return (tick >> (s_slot_bits * level)) & (s_num_slots - 1); }
+
+    intrusive_list_t<timer_callback_t> *list_of(uint32_t position);
+    void place(timer_callback_t *cb);
+    void move_all(intrusive_list_t<timer_callback_t> *list);
+
+    // The first tick after m_now_ms at which a timer expires or moves down, or
+    // UINT64_MAX if the wheel is empty
+    uint64_t next_event_tick() const;
+
+    intrusive_list_t<timer_callback_t> m_slots[s_num_levels][s_num_slots];
+    uint64_t m_occupied[s_num_levels]; // Bit `i` is set if slot `i` is not empty
+    intrusive_list_t<timer_callback_t> m_overflow;
+    intrusive_list_t<timer_callback_t> m_expired;
+
+    uint64_t m_now_ms; // Every timer due by this tick has been expired
+    size_t m_size;
+
+    DISABLE_COPYING(timer_wheel_t);
+};
+
+} // namespace indecorous
+
+#endif // CORO_TIMER_WHEEL_HPP_
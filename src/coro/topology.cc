@@ -0,0 +1,156 @@
+#include "coro/topology.hpp"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "utils.hpp"
+
+namespace indecorous {
+
+const cpu_topology_t *cpu_topology_t::instance() {
+    static cpu_topology_t topology;
+    return &topology;
+}
+
+cpu_topology_t::cpu_topology_t() :
+        m_num_nodes(1),
+        m_cpus(),
+        m_nodes(CPU_SETSIZE, 0) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    GUARANTEE_ERR(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            m_cpus.push_back(cpu);
+        }
+    }
+
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir != nullptr) {
+        while (struct dirent *entry = readdir(dir)) {
+            if (strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' || entry->d_name[4] > '9') {
+                continue;
+            }
+            int node = atoi(entry->d_name + 4);
+            m_num_nodes = std::max<size_t>(m_num_nodes, node + 1);
+
+            std::string path = std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist";
+            FILE *file = fopen(path.c_str(), "r");
+            if (file == nullptr) {
+                continue;
+            }
+            char list[4096];
+            if (fgets(list, sizeof(list), file) != nullptr) {
+                for (int cpu : parse_cpu_list(list)) {
+                    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                        m_nodes[cpu] = node;
+                    }
+                }
+            }
+            fclose(file);
+        }
+        closedir(dir);
+    }
+
+    std::stable_sort(m_cpus.begin(), m_cpus.end(),
+                     [this] (int a, int b) { return m_nodes[a] < m_nodes[b]; });
+}
+
+int cpu_topology_t::node_of(int cpu) const {
+    if (std::find(m_cpus.begin(), m_cpus.end(), cpu) == m_cpus.end()) {
+        return -1;
+    }
+    return m_nodes[cpu];
+}
+
+std::vector<int> cpu_topology_t::parse_cpu_list(const char *list) {
+    std::vector<int> res;
+    const char *pos = list;
+    while (*pos >= '0' && *pos <= '9') {
+        char *end;
+        int first = strtol(pos, &end, 10);
+        int last = first;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            res.push_back(cpu);
+        }
+        pos = (*end == ',') ? end + 1 : end;
+    }
+    return res;
+}
+
+thread_placement_t thread_placement_t::pinned(size_t num_coro_threads) {
+    const std::vector<int> &cpus = cpu_topology_t::instance()->cpus();
+    GUARANTEE(!cpus.empty());
+
+    thread_placement_t res;
+    for (size_t i = 0; i < num_coro_threads; ++i) {
+        res.coro_cpus.push_back({ cpus[i % cpus.size()] });
+    }
+    if (num_coro_threads < cpus.size()) {
+        res.io_cpus.assign(cpus.begin() + num_coro_threads, cpus.end());
+    } else {
+        res.io_cpus = cpus;
+    }
+    return res;
+}
+
+thread_topology_t thread_placement_t::coro_thread(size_t index) const {
+    if (coro_cpus.empty()) {
+        return thread_topology_t();
+    }
+    return make_topology(coro_cpus[index % coro_cpus.size()]);
+}
+
+thread_topology_t thread_placement_t::io_thread() const {
+    return make_topology(io_cpus);
+}
+
+thread_topology_t thread_placement_t::make_topology(std::vector<int> cpus) {
+    thread_topology_t res;
+    res.cpus = std::move(cpus);
+    if (!res.cpus.empty()) {
+        const cpu_topology_t *topology = cpu_topology_t::instance();
+        res.numa_node = topology->node_of(res.cpus.front());
+        for (int cpu : res.cpus) {
+            if (topology->node_of(cpu) != res.numa_node) {
+                res.numa_node = -1;
+                break;
+            }
+        }
+    }
+    return res;
+}
+
+bool apply_thread_topology(const thread_topology_t &topology) {
+    if (topology.cpus.empty()) {
+        return true;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : topology.cpus) {
+        GUARANTEE(cpu >= 0 && cpu < CPU_SETSIZE);
+        CPU_SET(cpu, &cpus);
+    }
+
+    // The process's cpuset may not allow these CPUs, running unpinned is still correct
+    int res = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (res != 0) {
+        logError("Could not pin thread to its CPUs, running unpinned: %s",
+                 string_error(res).c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace indecorous
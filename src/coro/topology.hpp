@@ -0,0 +1,72 @@
+#ifndef CORO_TOPOLOGY_HPP_
+#define CORO_TOPOLOGY_HPP_
+
+#include <cstddef>
+#include <vector>
+
+#include "common.hpp"
+
+namespace indecorous {
+
+// The CPUs this process may run on and their NUMA nodes, read once from sysfs.
+// Without NUMA information, every CPU is on node 0.
+class cpu_topology_t {
+public:
+    static const cpu_topology_t *instance();
+
+    // Ordered by node, then by CPU number
+    const std::vector<int> &cpus() const { return m_cpus; }
+    size_t num_nodes() const { return m_num_nodes; }
+    int node_of(int cpu) const; // -1 if `cpu` is not in cpus()
+
+private:
+    cpu_topology_t();
+
+    // Parses a sysfs CPU list, e.g. "0-3,8,10-11"
+    static std::vector<int> parse_cpu_list(const char *list);
+
+    size_t m_num_nodes;
+    std::vector<int> m_cpus;
+    std::vector<int> m_nodes; // Indexed by CPU number
+
+    DISABLE_COPYING(cpu_topology_t);
+};
+
+// Where a thread of a scheduler_t runs, see target_t::topology()
+struct thread_topology_t {
+    thread_topology_t() : cpus(), numa_node(-1) { }
+
+    std::vector<int> cpus; // Empty if the thread is not pinned
+    int numa_node; // -1 if not pinned to a single node
+};
+
+// Which CPUs the threads of a scheduler_t are pinned to.  Coro thread `i` is
+// pinned to coro_cpus[i % coro_cpus.size()], and every io thread to all of
+// io_cpus.  Empty lists leave the threads unpinned.  Threads pin themselves
+// before setting up their dispatcher_t, so their stacks, buffers and run
+// queues are first touched - and so allocated - on their own NUMA node.
+struct thread_placement_t {
+    thread_placement_t() : coro_cpus(), io_cpus() { }
+
+    // One CPU per coro thread, filling a NUMA node before moving on to the next
+    // so that neighbouring threads share a node.  Io threads get the CPUs left
+    // over, or share all of them if there are none left.
+    static thread_placement_t pinned(size_t num_coro_threads);
+
+    thread_topology_t coro_thread(size_t index) const;
+    thread_topology_t io_thread() const;
+
+    std::vector<std::vector<int> > coro_cpus;
+    std::vector<int> io_cpus;
+
+private:
+    static thread_topology_t make_topology(std::vector<int> cpus);
+};
+
+// Pins the calling thread to `topology.cpus`, if any.  Returns false, leaving
+// the thread unpinned, if the process may not run on those CPUs.
+bool apply_thread_topology(const thread_topology_t &topology);
+
+} // namespace indecorous
+
+#endif // CORO_TOPOLOGY_HPP_
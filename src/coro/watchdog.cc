@@ -0,0 +1,187 @@
+#include "coro/watchdog.hpp"
+
+#include <execinfo.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "coro/coro.hpp"
+#include "coro/cycle_clock.hpp"
+#include "coro/thread.hpp"
+
+namespace indecorous {
+
+stall_report_t::stall_report_t() :
+        stalled_ns(0),
+        spawn_site(nullptr),
+        rpc_id(0),
+        frames(),
+        num_frames(0) { }
+
+stall_state_t::stall_state_t() :
+        m_switches(0),
+        m_stalls(0),
+        m_capture(),
+        m_capture_pending(false),
+        m_mutex(),
+        m_last_report() { }
+
+stall_report_t stall_state_t::last_report() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_last_report;
+}
+
+std::atomic<uint64_t> stall_watchdog_t::s_threshold_ns(1000 * 1000 * 1000);
+
+const int stall_watchdog_t::s_signal = SIGURG;
+const uint64_t stall_watchdog_t::s_capture_timeout_ms = 100;
+
+std::mutex stall_watchdog_t::s_handler_mutex;
+size_t stall_watchdog_t::s_handler_users = 0;
+struct sigaction stall_watchdog_t::s_old_sigaction;
+
+stall_watchdog_t::stall_watchdog_t(std::vector<thread_t *> threads) :
+        m_threads(std::move(threads)),
+        m_mutex(),
+        m_cond(),
+        m_stopping(false),
+        m_thread() {
+    uint64_t threshold_ns = s_threshold_ns.load(std::memory_order_relaxed);
+    if (threshold_ns != 0) {
+        install_handler();
+
+        // Leave SIGINT and SIGTERM to the thread in scheduler_t::run (this is inherited)
+        sigset_t sigset;
+        sigset_t old_sigset;
+        GUARANTEE_ERR(sigemptyset(&sigset) == 0);
+        GUARANTEE_ERR(sigaddset(&sigset, SIGINT) == 0);
+        GUARANTEE_ERR(sigaddset(&sigset, SIGTERM) == 0);
+        GUARANTEE_ERR(sigaddset(&sigset, SIGPIPE) == 0);
+        GUARANTEE(pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset) == 0);
+        m_thread = std::thread(&stall_watchdog_t::main, this, threshold_ns);
+        GUARANTEE(pthread_sigmask(SIG_SETMASK, &old_sigset, nullptr) == 0);
+    }
+}
+
+stall_watchdog_t::~stall_watchdog_t() {
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cond.notify_all();
+        m_thread.join();
+        uninstall_handler();
+    }
+}
+
+void stall_watchdog_t::install_handler() {
+    std::lock_guard<std::mutex> lock(s_handler_mutex);
+    if (s_handler_users++ == 0) {
+        // The first call to backtrace() may allocate, which is not safe in the handler
+        void *frame;
+        backtrace(&frame, 1);
+
+        struct sigaction sigact;
+        memset(&sigact, 0, sizeof(sigact));
+        sigact.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+        sigact.sa_sigaction = &stall_watchdog_t::signal_handler;
+        sigemptyset(&sigact.sa_mask);
+        GUARANTEE_ERR(sigaction(s_signal, &sigact, &s_old_sigaction) == 0);
+    }
+}
+
+void stall_watchdog_t::uninstall_handler() {
+    std::lock_guard<std::mutex> lock(s_handler_mutex);
+    assert(s_handler_users > 0);
+    if (--s_handler_users == 0) {
+        GUARANTEE_ERR(sigaction(s_signal, &s_old_sigaction, nullptr) == 0);
+    }
+}
+
+// Runs on the stalled thread, so it must be async-signal-safe
+void stall_watchdog_t::signal_handler(int, siginfo_t *, void *) {
+    int saved_errno = errno;
+    thread_t *thread = thread_t::self();
+    stall_state_t *state = (thread == nullptr) ? nullptr : thread->stall_state();
+    if (state != nullptr && state->m_capture_pending.load(std::memory_order_acquire)) {
+        dispatcher_t *dispatch = thread->dispatcher();
+        coro_t *coro = (dispatch == nullptr) ? nullptr : dispatch->m_running;
+        stall_report_t *report = &state->m_capture;
+        report->spawn_site = (coro == nullptr) ? nullptr : coro->spawn_site();
+        report->rpc_id = (coro == nullptr) ? 0 : coro->rpc_id();
+        report->num_frames = backtrace(report->frames, stall_report_t::max_frames);
+        state->m_capture_pending.store(false, std::memory_order_release);
+    }
+    errno = saved_errno;
+}
+
+void stall_watchdog_t::main(uint64_t threshold_ns) {
+    const uint64_t threshold = cycle_clock_t::from_ns(threshold_ns);
+    const std::chrono::nanoseconds period(std::max<uint64_t>(threshold_ns / 4, 1000 * 1000));
+
+    // The switch count last seen on each thread and when it was first seen, and
+    // the last one reported, so a stall is only reported once
+    std::vector<uint64_t> seen(m_threads.size(), 0);
+    std::vector<uint64_t> seen_at(m_threads.size(), 0);
+    std::vector<uint64_t> reported(m_threads.size(), 0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_cond.wait_for(lock, period, [this] { return m_stopping; })) {
+        for (size_t i = 0; i < m_threads.size(); ++i) {
+            uint64_t switches = m_threads[i]->stall_state()->m_switches.load(std::memory_order_relaxed);
+            uint64_t now = cycle_clock_t::now();
+            if (switches != seen[i]) {
+                seen[i] = switches;
+                seen_at[i] = now;
+            } else if ((switches & 1) != 0 && switches != reported[i] &&
+                       now > seen_at[i] && now - seen_at[i] >= threshold) {
+                reported[i] = switches;
+                capture(m_threads[i], cycle_clock_t::to_ns(now - seen_at[i]));
+            }
+        }
+    }
+}
+
+void stall_watchdog_t::capture(thread_t *thread, uint64_t stalled_ns) {
+    stall_state_t *state = thread->stall_state();
+    stall_report_t report;
+
+    // A thread that never handled the last signal will not handle another one
+    if (!state->m_capture_pending.load(std::memory_order_acquire)) {
+        state->m_capture = stall_report_t();
+        state->m_capture_pending.store(true, std::memory_order_release);
+        GUARANTEE(pthread_kill(thread->m_thread.native_handle(), s_signal) == 0);
+
+        for (uint64_t waited_ms = 0; waited_ms < s_capture_timeout_ms; ++waited_ms) {
+            if (!state->m_capture_pending.load(std::memory_order_acquire)) {
+                report = state->m_capture;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    report.stalled_ns = stalled_ns;
+
+    {
+        std::lock_guard<std::mutex> lock(state->m_mutex);
+        state->m_last_report = report;
+        state->m_stalls.fetch_add(1, std::memory_order_release);
+    }
+
+    logError("Thread %" PRIu64 " has not polled for events in %" PRIu64 " ms, running %s (rpc %" PRIu64 ")",
+             thread->target()->id().value(), stalled_ns / (1000 * 1000),
+             (report.spawn_site == nullptr) ? "(no coroutine)" : report.spawn_site,
+             report.rpc_id);
+    char **symbols = backtrace_symbols(report.frames, report.num_frames);
+    for (size_t i = 0; i < report.num_frames; ++i) {
+        logError("  %s", (symbols == nullptr) ? "(unknown)" : symbols[i]);
+    }
+    free(symbols);
+}
+
+} // namespace indecorous
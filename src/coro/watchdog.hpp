@@ -0,0 +1,116 @@
+#ifndef CORO_WATCHDOG_HPP_
+#define CORO_WATCHDOG_HPP_
+
+#include <signal.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+
+namespace indecorous {
+
+class thread_t;
+
+// What a thread was running when the stall_watchdog_t caught it
+struct stall_report_t {
+    stall_report_t();
+
+    static const size_t max_frames = 32;
+
+    uint64_t stalled_ns; // How long the thread had gone without a context switch when caught
+    const char *spawn_site; // coro_t::spawn_site() of the running coroutine, null if none
+    uint64_t rpc_id; // coro_t::rpc_id() of the running coroutine
+    void *frames[max_frames]; // Return addresses on the stalled stack, see backtrace(3)
+    size_t num_frames;
+};
+
+// Written by the thread it belongs to, read by the stall_watchdog_t
+class stall_state_t {
+public:
+    stall_state_t();
+
+    // Called by the dispatcher_t around each run and on each context switch
+    // within it - the count is odd while running
+    void run_begin() { bump(1); }
+    void note_switch() { bump(2); }
+    void run_end() { bump(1); }
+
+    // Stalls caught on this thread, safe to read from other threads - the
+    // last_report() is in place once the count includes it
+    uint64_t stalls() const { return m_stalls.load(std::memory_order_acquire); }
+    stall_report_t last_report() const;
+
+private:
+    friend class stall_watchdog_t;
+
+    // Only written by this thread, so no read-modify-write is needed
+    void bump(uint64_t n) {
+        m_switches.store(m_switches.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> m_switches;
+    std::atomic<uint64_t> m_stalls;
+
+    // Filled in by the thread's signal handler on request of the watchdog
+    stall_report_t m_capture;
+    std::atomic<bool> m_capture_pending;
+
+    mutable std::mutex m_mutex;
+    stall_report_t m_last_report;
+
+    DISABLE_COPYING(stall_state_t);
+};
+
+// Notices threads that have not gone back to polling for events for longer than
+// s_threshold_ns.  A dispatcher_t returns to poll at least every time slice unless
+// one coroutine keeps the thread - e.g. in a long computation or a blocking
+// syscall - which holds up every other coroutine on the thread.  The stalled
+// thread is signalled to capture a backtrace of its stack, which is logged along
+// with the spawn site or RPC of the running coroutine, and each stall is counted
+// once in the thread's stall_state_t however long it lasts.  A stall is a run
+// that goes that long without a context switch, so several in one run are each
+// caught; the coroutine swap path only bumps a thread-local counter, and the
+// watchdog notes when it last saw each thread's counter change.
+class stall_watchdog_t {
+public:
+    explicit stall_watchdog_t(std::vector<thread_t *> threads);
+    ~stall_watchdog_t();
+
+    // Read when the watchdog starts, 0 disables it
+    static std::atomic<uint64_t> s_threshold_ns;
+
+private:
+    void main(uint64_t threshold_ns);
+    void capture(thread_t *thread, uint64_t stalled_ns);
+
+    static void install_handler();
+    static void uninstall_handler();
+    static void signal_handler(int, siginfo_t *, void *);
+
+    // Ignored by default, so a signal arriving after the handler is gone is harmless
+    static const int s_signal;
+    static const uint64_t s_capture_timeout_ms;
+
+    static std::mutex s_handler_mutex;
+    static size_t s_handler_users;
+    static struct sigaction s_old_sigaction;
+
+    const std::vector<thread_t *> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stopping;
+    std::thread m_thread;
+
+    DISABLE_COPYING(stall_watchdog_t);
+};
+
+} // namespace indecorous
+
+#endif // CORO_WATCHDOG_HPP_
@@ -31,6 +31,9 @@ private:
 
     void add_wait(wait_callback_t *cb) override final;
     void remove_wait(wait_callback_t *cb) override final;
+#if INDECOROUS_CORO_STATS
+    wait_category_t wait_category() const override final { return wait_category_t::Mutex; }
+#endif
 
     bool m_has;
     cross_thread_mutex_t *m_parent;
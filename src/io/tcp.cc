@@ -23,6 +23,7 @@ const char *peek_length_exc_t::what() const noexcept {
 // TODO: this probably isn't safe if someone has a read or write lock (or is acquiring one)
 tcp_conn_t::tcp_conn_t(tcp_conn_t &&other) :
         m_socket(std::move(other.m_socket)),
+        m_registration(std::move(other.m_registration)),
         m_in(std::move(other.m_in)),
         m_out(std::move(other.m_out)),
         m_read_mutex(std::move(other.m_read_mutex)),
@@ -32,6 +33,7 @@ tcp_conn_t::tcp_conn_t(tcp_conn_t &&other) :
 
 tcp_conn_t::tcp_conn_t(scoped_fd_t sock) :
         m_socket(std::move(sock)),
+        m_registration(m_socket.get()),
         m_in(file_wait_t::in(m_socket.get())),
         m_out(file_wait_t::out(m_socket.get())),
         m_read_mutex(),
@@ -43,6 +45,7 @@ tcp_conn_t::tcp_conn_t(scoped_fd_t sock) :
 
 tcp_conn_t::tcp_conn_t(const ip_and_port_t &ip_port) :
         m_socket(init_socket(ip_port)),
+        m_registration(m_socket.get()),
         m_in(file_wait_t::in(m_socket.get())),
         m_out(file_wait_t::out(m_socket.get())),
         m_read_mutex(),
@@ -45,6 +45,7 @@ private:
     void read_into_buffer();
 
     scoped_fd_t m_socket;
+    file_registration_t m_registration; // Reads and writes only wait after EAGAIN
     file_wait_t m_in;
     file_wait_t m_out;
 
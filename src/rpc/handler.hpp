@@ -6,6 +6,7 @@
 #include <type_traits>
 #include <unordered_map>
 
+#include "coro/coro.hpp"
 #include "rpc/message.hpp"
 #include "rpc/serialize.hpp"
 
@@ -18,8 +19,15 @@ struct rpc_callback_t {
     virtual write_message_t handle(read_message_t msg) = 0;
     virtual void handle_noreply(read_message_t msg) = 0;
     virtual rpc_id_t id() const = 0;
+
+    // The priority of the coroutines that handle this RPC
+    virtual priority_t priority() const { return priority_t::Normal; }
 };
 
+// Used for the optional priority argument of DECLARE_STATIC_RPC
+constexpr priority_t rpc_default_priority() { return priority_t::Normal; }
+constexpr priority_t rpc_default_priority(priority_t priority) { return priority; }
+
 // TODO: put this someplace sensical
 std::unordered_map<rpc_id_t, rpc_callback_t *> &register_callback(rpc_callback_t *cb);
 
@@ -35,6 +43,9 @@ struct static_rpc_t : public rpc_callback_t {
     rpc_id_t id() const override final {
         return T::s_rpc_id;
     }
+    priority_t priority() const override final {
+        return T::s_priority;
+    }
 };
 
 
@@ -48,11 +59,13 @@ struct static_rpc_registration_t {
 
 template <typename... Args>
 struct write_generator_t {
-    static write_message_t make(target_id_t src,
+    static write_message_t make(uint64_t deadline_ns,
+                                target_id_t src,
                                 rpc_id_t rpc,
                                 request_id_t req,
                                 Args &&...args) {
-        return write_message_t::create(src, rpc, req, std::forward<Args>(args)...);
+        return write_message_t::create_with_deadline(deadline_ns, src, rpc, req,
+                                                     std::forward<Args>(args)...);
     }
 };
 
@@ -88,6 +101,7 @@ rpc_bridge_t<Res, Args...> rpc_bridge(Res(*fn)(Args...));
         indecorous::rpc_id_t id() const override final; \
         static auto fn_ptr() { return &enclosing_t::RPC ## _indecorous_callback; } \
         static const indecorous::rpc_id_t s_rpc_id; \
+        static constexpr bool s_stealable = false; \
         enclosing_t * const m_parent; \
     } RPC ## _indecorous_rpc = RPC(this); \
     auto RPC ## _indecorous_callback
@@ -111,7 +125,7 @@ rpc_bridge_t<Res, Args...> rpc_bridge(Res(*fn)(Args...));
     } \
     auto RPC ## _indecorous_callback
 
-#define DECLARE_STATIC_RPC(RPC) \
+#define INDECOROUS_DECLARE_STATIC_RPC(RPC, stealable, priority) \
     struct RPC : public indecorous::static_rpc_t<RPC> { \
         RPC() = delete; \
         static indecorous::write_message_t static_handle(indecorous::read_message_t msg); \
@@ -119,9 +133,22 @@ rpc_bridge_t<Res, Args...> rpc_bridge(Res(*fn)(Args...));
         static auto fn_ptr() { return &RPC ## _indecorous_callback; } \
         static const indecorous::rpc_id_t s_rpc_id; \
         static const indecorous::static_rpc_registration_t<RPC> s_registration; \
+        static constexpr bool s_stealable = (stealable); \
+        static constexpr indecorous::priority_t s_priority = (priority); \
     }; \
     static auto RPC ## _indecorous_callback
 
+// An optional priority_t may be given for the coroutines handling the RPC, e.g.
+//   DECLARE_STATIC_RPC(ping, indecorous::priority_t::High)() -> void;
+#define DECLARE_STATIC_RPC(RPC, ...) \
+    INDECOROUS_DECLARE_STATIC_RPC(RPC, false, indecorous::rpc_default_priority(__VA_ARGS__))
+
+// Calls to a stealable RPC that have not started yet may be run by any idle coro
+// thread rather than the one they were sent to.  Don't use this for handlers that
+// rely on running on a particular thread (e.g. through home_threaded_t).
+#define DECLARE_STEALABLE_STATIC_RPC(RPC, ...) \
+    INDECOROUS_DECLARE_STATIC_RPC(RPC, true, indecorous::rpc_default_priority(__VA_ARGS__))
+
 #define IMPL_STATIC_RPC(RPC) \
     INDECOROUS_UNIQUE_RPC(RPC); \
     indecorous::write_message_t RPC::static_handle(indecorous::read_message_t msg) { \
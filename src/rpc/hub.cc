@@ -6,6 +6,7 @@
 #include "rpc/target.hpp"
 
 #include "coro/thread.hpp"
+#include "random.hpp"
 
 namespace indecorous {
 
@@ -14,22 +15,40 @@ message_hub_t::message_hub_t(target_t *self_target, target_t *_io_target) :
     m_self_target_id(self_target->id()),
     m_io_target(_io_target),
     m_local_targets(),
+    m_all_local_targets(),
     m_targets(),
     m_rpcs(register_callback(nullptr)),
     m_request_gen(),
     m_task_gen(),
-    m_replies() { }
+    m_replies()
+#if INDECOROUS_CORO_STATS
+    , m_rpc_stats()
+#endif
+#if INDECOROUS_STACK_STATS
+    , m_rpc_stack_depths()
+#endif
+    { }
 
 message_hub_t::~message_hub_t() { }
 
 void message_hub_t::handle(task_id_t task_id, rpc_callback_t *rpc, read_message_t msg) {
     target_id_t source_id = msg.source_id;
+#if INDECOROUS_CORO_STATS
+    rpc_id_t rpc_id = msg.rpc_id;
+#endif
     logDebug("Starting task %" PRIu64, task_id.value());
+    coro_t::self()->m_rpc_id = msg.rpc_id.value();
+#if INDECOROUS_STACK_STATS
+    coro_t::self()->set_stack_histogram(&m_rpc_stack_depths[msg.rpc_id]);
+#endif
 
     if (msg.request_id == request_id_t::noreply()) {
         rpc->handle_noreply(std::move(msg));
+        coro_t::migrate_home();
     } else {
         write_message_t reply = rpc->handle(std::move(msg));
+        // The handler may have moved, the reply and stats belong to this hub's thread
+        coro_t::migrate_home();
 
         target_t *source = target(source_id);
         if (source != nullptr) {
@@ -40,6 +59,13 @@ void message_hub_t::handle(task_id_t task_id, rpc_callback_t *rpc, read_message_
     }
 
     logDebug("Finished task %" PRIu64, task_id.value());
+
+#if INDECOROUS_CORO_STATS
+    // Each task runs in its own coroutine, so its stats cover just this call
+    rpc_stats_t &stats = m_rpc_stats[rpc_id];
+    stats.calls += 1;
+    stats.time += coro_t::self()->stats();
+#endif
 }
 
 target_t::request_params_t message_hub_t::new_request() {
@@ -59,21 +85,45 @@ void message_hub_t::spawn_task(read_message_t msg) {
             logInfo("Orphan reply encountered for request %" PRIu64 ":%" PRIu64,
                     msg.source_id.value(), msg.request_id.value());
         }
+    } else if (msg.rpc_id == rpc_id_t::migrate()) {
+        uint64_t coro = serializer_t<uint64_t>::read(&msg);
+        coro_t::accept_migration(reinterpret_cast<coro_t *>(coro));
     } else {
         if (msg.source_id.is_local()) {
             thread_t::self()->dispatcher()->note_accepted_task();
         }
 
         auto cb_it = m_rpcs.find(msg.rpc_id);
-        if (msg.request_id == request_id_t::noreply() || cb_it != m_rpcs.end()) {
+        if (cb_it != m_rpcs.end()) {
             const task_id_t task_id = m_task_gen.next();
-            coro_t::spawn_detached(&message_hub_t::handle, this, task_id, cb_it->second, std::move(msg));
+            spawn_options_t options(cb_it->second->priority());
+            if (msg.deadline_ns != 0) {
+                options.deadline = deadline_t::in_ns(msg.deadline_ns);
+            }
+            coro_t::spawn_detached(options,
+                                   &message_hub_t::handle, this, task_id, cb_it->second, std::move(msg));
         } else {
             logError("No registered RPC for rpc_id (%lu).", msg.rpc_id.value());
         }
     }
 }
 
+#if INDECOROUS_CORO_STATS
+message_hub_t::rpc_stats_t::rpc_stats_t() :
+    calls(0),
+    time() { }
+
+const std::unordered_map<rpc_id_t, message_hub_t::rpc_stats_t> &message_hub_t::rpc_stats() const {
+    return m_rpc_stats;
+}
+#endif
+
+#if INDECOROUS_STACK_STATS
+const std::unordered_map<rpc_id_t, stack_histogram_t> &message_hub_t::rpc_stack_depths() const {
+    return m_rpc_stack_depths;
+}
+#endif
+
 target_t *message_hub_t::target(target_id_t id) {
     auto it = m_targets.find(id);
     return (it == m_targets.end()) ? nullptr : it->second;
@@ -87,9 +137,51 @@ const std::vector<target_t *> &message_hub_t::local_targets() {
     return m_local_targets;
 }
 
+target_t *message_hub_t::pick_target() {
+    assert(!m_local_targets.empty());
+    size_t count = m_local_targets.size();
+    if (count == 1) {
+        return m_local_targets[0];
+    }
+
+    // Two distinct candidates
+    size_t a = pseudo_random_t::s_instance.generate<uint32_t>() % count;
+    size_t b = pseudo_random_t::s_instance.generate<uint32_t>() % (count - 1);
+    if (b >= a) {
+        ++b;
+    }
+
+    stream_load_t load_a = m_local_targets[a]->load();
+    stream_load_t load_b = m_local_targets[b]->load();
+    size_t backlog_a = load_a.queued + load_a.runnable;
+    size_t backlog_b = load_b.queued + load_b.runnable;
+    if (backlog_a != backlog_b) {
+        return m_local_targets[(backlog_a < backlog_b) ? a : b];
+    }
+    return m_local_targets[(load_a.latency_ns <= load_b.latency_ns) ? a : b];
+}
+
+const std::vector<target_t *> &message_hub_t::all_local_targets() {
+    return m_all_local_targets;
+}
+
 void message_hub_t::add_local_target(target_t *t) {
     m_local_targets.emplace_back(t);
+    m_all_local_targets.emplace_back(t);
     m_targets.emplace(t->id(), t);
 }
 
+bool message_hub_t::set_num_active(size_t num_active) {
+    assert(num_active > 0 && num_active <= m_all_local_targets.size());
+    m_local_targets.assign(m_all_local_targets.begin(), m_all_local_targets.begin() + num_active);
+
+    // Io threads are not in the pool, so they are never parked
+    for (size_t i = num_active; i < m_all_local_targets.size(); ++i) {
+        if (m_all_local_targets[i]->id() == m_self_target_id) {
+            return false;
+        }
+    }
+    return true;
+}
+
 } // namespace indecorous
@@ -27,8 +27,53 @@ public:
     target_t *target(target_id_t id);
     target_t *io_target();
 
+    // The targets of the active coro threads, see scheduler_t::resize().  This is
+    // only updated by the owning thread between runs of its dispatcher_t.
     const std::vector<target_t *> &local_targets();
 
+    // Every coro thread, including parked ones
+    const std::vector<target_t *> &all_local_targets();
+
+#if INDECOROUS_CORO_STATS
+    // Totals over the handlers of each RPC run on this thread
+    struct rpc_stats_t {
+        rpc_stats_t();
+        uint64_t calls;
+        coro_stats_t time;
+    };
+    const std::unordered_map<rpc_id_t, rpc_stats_t> &rpc_stats() const;
+#endif
+
+#if INDECOROUS_STACK_STATS
+    // Deepest stack use of the handlers of each RPC run on this thread
+    const std::unordered_map<rpc_id_t, stack_histogram_t> &rpc_stack_depths() const;
+#endif
+
+    // Picks one of local_targets() by load.  Two candidates are drawn at random,
+    // and the one with fewer queued messages and runnable coroutines wins, or
+    // the one with shorter recent dispatcher runs on a tie.  Comparing just two
+    // is nearly as good as finding the least loaded thread, without reading
+    // every thread's load or herding onto one thread while its load is stale.
+    target_t *pick_target();
+
+    // Calls an RPC on a target chosen by pick_target()
+    template <typename RPC, typename... Args>
+    void call_any_noreply(Args &&...args) {
+        pick_target()->call_noreply<RPC>(std::forward<Args>(args)...);
+    }
+
+    template <typename RPC, typename... Args,
+              typename Res = typename decltype(rpc_bridge(RPC::fn_ptr()))::result_t>
+    future_t<Res> call_any_async(Args &&...args) {
+        return pick_target()->call_async<RPC>(std::forward<Args>(args)...);
+    }
+
+    template <typename RPC, typename... Args,
+              typename Res = typename decltype(rpc_bridge(RPC::fn_ptr()))::result_t>
+    Res call_any_sync(Args &&...args) {
+        return pick_target()->call_sync<RPC>(std::forward<Args>(args)...);
+    }
+
     template <typename RPC, typename... Args>
     size_t broadcast_local_noreply(Args &&...args) {
         for (auto &&t : m_local_targets) {
@@ -53,6 +98,7 @@ public:
     typename std::enable_if<std::is_void<Res>::value, void>::type
     broadcast_local_sync(Args &&...args) {
         std::vector<future_t<Res> > futures = broadcast_local_async<RPC>(std::forward<Args>(args)...);
+        wait_category_scope_t category_scope(wait_category_t::RpcReply);
         wait_all(futures);
     }
 
@@ -63,6 +109,7 @@ public:
         std::vector<future_t<Res> > futures = broadcast_local_async<RPC>(std::forward<Args>(args)...);
         std::vector<Res> res;
         res.reserve(futures.size());
+        wait_category_scope_t category_scope(wait_category_t::RpcReply);
         wait_all(futures);
         for (auto &&f : futures) {
             res.emplace_back(f.release());
@@ -74,11 +121,14 @@ private:
     friend class scheduler_t; // For initializing local and io targets
     void add_local_target(target_t *t);
 
-    // For spawning received RPCs
+    // For spawning received RPCs and resizing the pool
     friend class thread_t;
     friend class io_thread_t;
     void spawn_task(read_message_t msg);
 
+    // Returns whether this hub's own target is still active
+    bool set_num_active(size_t num_active);
+
     friend class target_t; // For generating new request ids and promises
     target_t::request_params_t new_request();
 
@@ -87,6 +137,7 @@ private:
     const target_id_t m_self_target_id;
     target_t * const m_io_target;
     std::vector<target_t *> m_local_targets;
+    std::vector<target_t *> m_all_local_targets;
     std::unordered_map<target_id_t, target_t *> m_targets;
     std::unordered_map<rpc_id_t, rpc_callback_t *> m_rpcs;
 
@@ -94,6 +145,14 @@ private:
     id_generator_t<task_id_t> m_task_gen;
     std::unordered_map<request_id_t, promise_t<read_message_t> > m_replies;
 
+#if INDECOROUS_CORO_STATS
+    std::unordered_map<rpc_id_t, rpc_stats_t> m_rpc_stats;
+#endif
+
+#if INDECOROUS_STACK_STATS
+    std::unordered_map<rpc_id_t, stack_histogram_t> m_rpc_stack_depths;
+#endif
+
     DISABLE_COPYING(message_hub_t);
 };
 
@@ -40,6 +40,10 @@ rpc_id_t rpc_id_t::reply() {
     return rpc_id_t(std::numeric_limits<uint64_t>::max());
 }
 
+rpc_id_t rpc_id_t::migrate() {
+    return rpc_id_t(std::numeric_limits<uint64_t>::max() - 1);
+}
+
 request_id_t::request_id_t(uint64_t _value) :
     value_(_value) { }
 
@@ -39,6 +39,7 @@ public:
     explicit rpc_id_t(uint64_t _value);
     uint64_t value() const;
     static rpc_id_t reply();
+    static rpc_id_t migrate(); // Carries a coroutine moving to the receiving thread
     bool operator ==(const rpc_id_t &other) const;
 private:
     uint64_t value_;
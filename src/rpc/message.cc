@@ -12,12 +12,14 @@ struct message_header_t {
     uint64_t source_id;
     uint64_t rpc_id;
     uint64_t request_id;
+    uint64_t deadline_ns;
     uint64_t payload_size;
     MAKE_SERIALIZABLE(message_header_t,
                       magic,
                       source_id,
                       rpc_id,
                       request_id,
+                      deadline_ns,
                       payload_size);
 };
 
@@ -26,10 +28,12 @@ const uint64_t message_header_t::MAGIC = 0x302ca58d7f47e0be;
 write_message_t::write_message_t(target_id_t source_id,
                                  rpc_id_t rpc_id,
                                  request_id_t request_id,
+                                 uint64_t deadline_ns,
                                  size_t payload_size) :
         m_buffer(sizeof(message_header_t) + payload_size),
         m_usage(0) {
-    message_header_t header(message_header_t::MAGIC, source_id.value(), rpc_id.value(), request_id.value(), payload_size);
+    message_header_t header(message_header_t::MAGIC, source_id.value(), rpc_id.value(),
+                            request_id.value(), deadline_ns, payload_size);
     assert(serializer_t<message_header_t>::size(header) == sizeof(message_header_t));
     serializer_t<message_header_t>::write(this, std::move(header));
 }
@@ -49,12 +53,14 @@ read_message_t::read_message_t(buffer_owner_t _buffer,
                                size_t _offset,
                                target_id_t _source_id,
                                rpc_id_t _rpc_id,
-                               request_id_t _request_id) :
+                               request_id_t _request_id,
+                               uint64_t _deadline_ns) :
     buffer(std::move(_buffer)),
     offset(_offset),
     source_id(std::move(_source_id)),
     rpc_id(std::move(_rpc_id)),
-    request_id(std::move(_request_id)) {
+    request_id(std::move(_request_id)),
+    deadline_ns(_deadline_ns) {
 }
 
 char read_message_t::pop() {
@@ -64,19 +70,20 @@ char read_message_t::pop() {
 
 read_message_t read_message_t::empty() {
     return read_message_t(buffer_owner_t::empty(), 0,
-                          target_id_t(-1), rpc_id_t(-1), request_id_t(-1));
+                          target_id_t(-1), rpc_id_t(-1), request_id_t(-1), 0);
 }
 
 read_message_t read_message_t::parse(buffer_owner_t &&buffer) {
     read_message_t message(std::move(buffer), 0,
-                           target_id_t(-1), rpc_id_t(-1), request_id_t(-1));
+                           target_id_t(-1), rpc_id_t(-1), request_id_t(-1), 0);
     message_header_t header = serializer_t<message_header_t>::read(&message);
     assert(header.magic == message_header_t::MAGIC);
 
     return read_message_t(std::move(message.buffer), message.offset,
                           target_id_t(header.source_id),
                           rpc_id_t(header.rpc_id),
-                          request_id_t(header.request_id));
+                          request_id_t(header.request_id),
+                          header.deadline_ns);
 }
 
 read_message_t read_message_t::parse(tcp_stream_t *stream) {
@@ -87,7 +94,7 @@ read_message_t read_message_t::parse(tcp_stream_t *stream) {
     stream->read_exactly(header_buffer.data(), header_buffer.capacity());
 
     read_message_t message(std::move(header_buffer), 0,
-                           target_id_t(-1), rpc_id_t(-1), request_id_t(-1));
+                           target_id_t(-1), rpc_id_t(-1), request_id_t(-1), 0);
     message_header_t header = serializer_t<message_header_t>::read(&message);
     assert(header.magic == message_header_t::MAGIC);
 
@@ -97,7 +104,8 @@ read_message_t read_message_t::parse(tcp_stream_t *stream) {
     return read_message_t(std::move(body_buffer), 0,
                           target_id_t(header.source_id),
                           rpc_id_t(header.rpc_id),
-                          request_id_t(header.request_id));
+                          request_id_t(header.request_id),
+                          header.deadline_ns);
 }
 
 } // namespace indecorous
@@ -19,6 +19,15 @@ public:
                                   rpc_id_t rpc_id,
                                   request_id_t request_id,
                                   Args &&...args);
+
+    // As above, but carrying the time left until the sender's deadline - the
+    // receiver spawns the handler with the same remaining time, see deadline_t
+    template <typename... Args>
+    static write_message_t create_with_deadline(uint64_t deadline_ns,
+                                                target_id_t source_id,
+                                                rpc_id_t rpc_id,
+                                                request_id_t request_id,
+                                                Args &&...args);
     write_message_t(write_message_t &&other) = default;
 
     void push_back(char c);
@@ -29,6 +38,7 @@ private:
     write_message_t(target_id_t source_id,
                     rpc_id_t rpc_id,
                     request_id_t request_id,
+                    uint64_t deadline_ns,
                     size_t payload_size);
 
     buffer_owner_t m_buffer;
@@ -49,13 +59,15 @@ public:
     target_id_t source_id;
     rpc_id_t rpc_id;
     request_id_t request_id;
+    uint64_t deadline_ns; // 0 if the sender had no deadline
 
 private:
     read_message_t(buffer_owner_t _buffer,
                    size_t _offset,
                    target_id_t _source_id,
                    rpc_id_t _rpc_id,
-                   request_id_t _request_id);
+                   request_id_t _request_id,
+                   uint64_t _deadline_ns);
 };
 
 template <typename... Args>
@@ -63,7 +75,16 @@ write_message_t write_message_t::create(target_id_t source_id,
                                         rpc_id_t rpc_id,
                                         request_id_t request_id,
                                         Args &&...args) {
-    write_message_t res(source_id, rpc_id, request_id,
+    return create_with_deadline(0, source_id, rpc_id, request_id, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+write_message_t write_message_t::create_with_deadline(uint64_t deadline_ns,
+                                                      target_id_t source_id,
+                                                      rpc_id_t rpc_id,
+                                                      request_id_t request_id,
+                                                      Args &&...args) {
+    write_message_t res(source_id, rpc_id, request_id, deadline_ns,
                         full_serialized_size(std::forward<Args>(args)...));
     full_serialize(&res, std::forward<Args>(args)...);
     return res;
@@ -4,6 +4,7 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <limits>
 
 #include "rpc/message.hpp"
 #include "sync/file_wait.hpp"
@@ -14,48 +15,173 @@ namespace indecorous {
 
 stream_t::~stream_t() { }
 
+stream_load_t stream_t::load() const {
+    return stream_load_t();
+}
+
+void stream_t::write_stealable(write_message_t &&msg) {
+    write(std::move(msg));
+}
+
 local_stream_t::local_stream_t() :
         m_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
-        m_queue() {
+        m_queue(),
+        m_drained(0),
+        m_queued(0),
+        m_runnable(0),
+        m_latency_ns(0),
+        m_steal_lock(),
+        m_steal_queue(),
+        m_steal_count(0),
+        m_idle(false),
+        m_peers(),
+        m_next_peer(0) {
     assert(m_fd.valid());
 }
 
-void local_stream_t::write(write_message_t &&msg) {
-    m_queue.push(std::move(msg).release().release());
-
+void local_stream_t::notify() {
     // TODO: would be nice to batch these, reduce system call overhead
     // don't want to increase latency, though =(
     uint64_t value = 1;
     GUARANTEE_ERR(::write(m_fd.get(), &value, sizeof(value)) == sizeof(value));
 }
 
+void local_stream_t::write(write_message_t &&msg) {
+    m_queue.push(std::move(msg).release().release());
+    notify();
+}
+
+void local_stream_t::write_stealable(write_message_t &&msg) {
+    m_steal_queue.push(std::move(msg).release().release());
+    m_steal_count.fetch_add(1);
+    notify();
+
+    // Wake up one idle peer in case this thread is too busy to get to it soon
+    for (auto &&peer : m_peers) {
+        if (peer->m_idle.load()) {
+            peer->notify();
+            break;
+        }
+    }
+}
+
 read_message_t local_stream_t::read() {
     buffer_owner_t buffer = buffer_owner_t::from_heap(m_queue.pop());
 
     if (buffer.has()) {
+        ++m_drained;
         return read_message_t::parse(std::move(buffer));
     }
 
     return read_message_t::empty();
 }
 
+read_message_t local_stream_t::steal() {
+    if (m_steal_count.load() == 0) {
+        return read_message_t::empty();
+    }
+
+    linkable_buffer_t *raw_buffer;
+    {
+        spinlock_acq_t lock(&m_steal_lock);
+        raw_buffer = m_steal_queue.pop();
+    }
+
+    if (raw_buffer == nullptr) {
+        return read_message_t::empty();
+    }
+
+    m_steal_count.fetch_sub(1);
+    return read_message_t::parse(buffer_owner_t::from_heap(raw_buffer));
+}
+
+read_message_t local_stream_t::steal_from_peers() {
+    // Start from a different peer each time to spread out contention
+    for (size_t i = 0; i < m_peers.size(); ++i) {
+        local_stream_t *peer = m_peers[(m_next_peer + i) % m_peers.size()];
+        read_message_t msg = peer->steal();
+        if (msg.buffer.has()) {
+            m_next_peer += i + 1;
+            return msg;
+        }
+    }
+    return read_message_t::empty();
+}
+
+bool local_stream_t::has_stealable() const {
+    return m_steal_count.load() != 0;
+}
+
+bool local_stream_t::has_pending() const {
+    return !m_queue.empty() || has_stealable();
+}
+
+void local_stream_t::set_idle(bool idle) {
+    m_idle.store(idle);
+
+    // A peer that wrote a stealable message just before this saw no idle
+    // stream to wake.  Both sides are seq_cst, so either it sees m_idle or
+    // this sees its message.
+    if (idle) {
+        for (auto &&peer : m_peers) {
+            if (peer->has_stealable()) {
+                notify();
+                break;
+            }
+        }
+    }
+}
+
+void local_stream_t::wake() {
+    notify();
+}
+
+stream_load_t local_stream_t::load() const {
+    // The steal count is updated after the push, so a thief may briefly take it below zero
+    size_t stealable = m_steal_count.load(std::memory_order_relaxed);
+    if (stealable > std::numeric_limits<size_t>::max() / 2) {
+        stealable = 0;
+    }
+
+    stream_load_t res;
+    res.queued = m_queued.load(std::memory_order_relaxed) + stealable;
+    res.runnable = m_runnable.load(std::memory_order_relaxed);
+    res.latency_ns = m_latency_ns.load(std::memory_order_relaxed);
+    return res;
+}
+
+void local_stream_t::publish_load(size_t runnable, uint64_t latency_ns) {
+    // Senders only read the depth, rather than all contending on a counter
+    m_queued.store(m_drained, std::memory_order_relaxed);
+    m_drained = 0;
+    m_runnable.store(runnable, std::memory_order_relaxed);
+    m_latency_ns.store(latency_ns, std::memory_order_relaxed);
+}
+
+void local_stream_t::add_peer(local_stream_t *peer) {
+    assert(peer != this);
+    m_peers.push_back(peer);
+}
+
 void local_stream_t::wait() {
     // TODO: this involves a TLS-lookup, but it's only used from a place that
     // already has the TLS value.
     file_wait_t::in(m_fd.get()).wait();
 
     // Clear the eventfd now - this may result in a spurious wakeup later, but
-    // better than missing a message.
-    uint64_t value;
-    auto res = eintr_wrap([&] { return ::read(m_fd.get(), &value, sizeof(value)); });
+    // better than missing a message.  The wakeup may also have been spurious,
+    // so the eventfd may already be clear.
+    uint64_t value = 0;
+    ssize_t res = ::read(m_fd.get(), &value, sizeof(value));
     if (res != sizeof(value)) {
-        GUARANTEE_ERR(errno == EAGAIN || errno == EWOULDBLOCK);
+        GUARANTEE_ERR(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    } else {
+        assert(value > 0);
     }
-    assert(value > 0);
 }
 
 size_t local_stream_t::size() const {
-    return m_queue.size();
+    return m_queue.size() + m_steal_queue.size();
 }
 
 io_stream_t::io_stream_t() :
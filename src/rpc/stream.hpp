@@ -3,9 +3,11 @@
 
 #include <semaphore.h>
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <queue>
+#include <vector>
 
 #include "containers/buffer.hpp"
 #include "containers/file.hpp"
@@ -17,10 +19,26 @@ namespace indecorous {
 class write_message_t;
 class read_message_t;
 
+// How busy the thread reading a stream is, see message_hub_t::call_any_noreply()
+struct stream_load_t {
+    stream_load_t() : queued(0), runnable(0), latency_ns(0) { }
+
+    size_t queued; // Messages the reader drained before its last dispatcher run, and stealable ones
+    size_t runnable; // Coroutines and tasks ready to run after the last dispatcher run
+    uint64_t latency_ns; // Moving average of the dispatcher's run times
+};
+
 class stream_t {
 public:
     virtual ~stream_t();
     virtual void write(write_message_t &&) = 0;
+
+    // Streams that don't know about their reader report no load
+    virtual stream_load_t load() const;
+
+    // Stealable messages may be handled by a different thread than the one
+    // they were sent to - streams that don't support this treat them normally
+    virtual void write_stealable(write_message_t &&msg);
     virtual read_message_t read() = 0;
     virtual void wait() = 0;
 };
@@ -29,17 +47,67 @@ class local_stream_t final : public stream_t {
 public:
     local_stream_t();
     void write(write_message_t &&msg) override final;
+    void write_stealable(write_message_t &&msg) override final;
+
+    // `read()` only returns non-stealable messages, use `steal()` for the rest
     read_message_t read() override final;
 
+    // `steal()` may be called from any thread, but `steal_from_peers()` must only
+    // be called from the thread reading this stream
+    read_message_t steal();
+    read_message_t steal_from_peers();
+    bool has_stealable() const;
+
+    // Whether any messages have been written since the last reads, safe to call
+    // from any thread.  Cheaper than waiting on the eventfd, for busy-polling.
+    bool has_pending() const;
+
     // `wait()` must only be called from within a coroutine context
     void wait() override final;
 
+    // The eventfd `wait()` waits on, so the reading thread can register it
+    fd_t fd() const { return m_fd.get(); }
+
+    // Idle streams are woken up when a peer receives a stealable message, and
+    // wake themselves if a peer already has one
+    void set_idle(bool idle);
+
+    // Wakes up the reading thread without a message, may be called from any thread
+    void wake();
+
+    // Safe to call from any thread
+    stream_load_t load() const override final;
+
+    // Called by the reading thread after each run of its dispatcher_t, along with
+    // the messages read since the last call this becomes the `load()`
+    void publish_load(size_t runnable, uint64_t latency_ns);
+
+    // `add_peer()` is not thread-safe, only use it when threads are not running
+    void add_peer(local_stream_t *peer);
+
     // `size()` is not thread-safe, only use it when threads are not running
     size_t size() const;
 
 private:
+    void notify();
+
     scoped_fd_t m_fd;
     mpsc_queue_t<linkable_buffer_t> m_queue;
+
+    // Only written by the reading thread
+    size_t m_drained; // Read since the last `publish_load()`
+    std::atomic<size_t> m_queued;
+    std::atomic<size_t> m_runnable;
+    std::atomic<uint64_t> m_latency_ns;
+
+    // Stealable messages can be read from any thread, so reads are locked
+    spinlock_t m_steal_lock;
+    mpsc_queue_t<linkable_buffer_t> m_steal_queue;
+    std::atomic<size_t> m_steal_count;
+
+    std::atomic<bool> m_idle;
+    std::vector<local_stream_t *> m_peers;
+    size_t m_next_peer;
 };
 
 class io_stream_t final : public stream_t {
@@ -1,5 +1,8 @@
 #include "rpc/target.hpp"
 
+#include <algorithm>
+
+#include "coro/coro.hpp"
 #include "coro/shutdown.hpp"
 #include "coro/thread.hpp"
 #include "rpc/hub.hpp"
@@ -7,7 +10,8 @@
 namespace indecorous {
 
 target_t::target_t() :
-    target_id(target_id_t::assign()) { }
+    target_id(target_id_t::assign()),
+    m_topology() { }
 
 target_t::~target_t() { }
 
@@ -28,6 +32,20 @@ void target_t::note_send() const {
     }
 }
 
+uint64_t target_t::request_deadline_ns() {
+    thread_t *t = thread_t::self();
+    if (t == nullptr || t->dispatcher() == nullptr || t->dispatcher()->m_running == nullptr) {
+        return 0;
+    }
+
+    deadline_t deadline = t->dispatcher()->m_running->deadline();
+    if (!deadline.is_set()) {
+        return 0;
+    }
+    // An expired deadline is still a deadline
+    return std::max<uint64_t>(deadline.remaining_ns(), 1);
+}
+
 void target_t::send_reply(write_message_t &&msg) {
     // Replies do not have to note a send - there should already be a coroutine waiting
     // to receive the reply - if not it gets discarded.
@@ -35,6 +53,15 @@ void target_t::send_reply(write_message_t &&msg) {
     stream()->write(std::move(msg));
 }
 
+void target_t::send_migration(coro_t *coro) {
+    // Not a new task - the coroutine still counts against shutdown from when it
+    // was spawned
+    stream()->write(write_message_t::create(thread_t::self()->target()->id(),
+                                            rpc_id_t::migrate(),
+                                            request_id_t::noreply(),
+                                            reinterpret_cast<uint64_t>(coro)));
+}
+
 target_t::request_params_t target_t::new_request() const {
     return thread_t::self()->hub()->new_request();
 }
@@ -4,10 +4,12 @@
 #include <unordered_map>
 
 #include "coro/coro.hpp"
+#include "coro/topology.hpp"
 #include "rpc/handler.hpp"
 #include "rpc/id.hpp"
 #include "rpc/message.hpp"
 #include "rpc/stream.hpp"
+#include "coro/stats.hpp"
 #include "sync/promise.hpp"
 
 namespace indecorous {
@@ -23,6 +25,12 @@ public:
 
     virtual bool is_local() const = 0;
 
+    // Where the thread behind a local target runs, see thread_placement_t
+    const thread_topology_t &topology() const { return m_topology; }
+
+    // How busy the thread behind this target is, safe to call from any thread
+    stream_load_t load() { return stream()->load(); }
+
     template <typename RPC, typename... Args>
     void call_noreply(Args &&...args) {
         note_send();
@@ -36,6 +44,7 @@ public:
         note_send();
         auto params = new_request();
         send_request<RPC>(params.source_id, params.request_id, std::forward<Args>(args)...);
+        wait_category_scope_t category_scope(wait_category_t::RpcReply);
         read_message_t reply(params.future.release());
         return serializer_t<Res>::read(&reply);
     }
@@ -57,9 +66,11 @@ protected:
     virtual stream_t *stream() = 0;
 
     target_id_t target_id;
+    thread_topology_t m_topology;
 
 private:
     friend class message_hub_t;
+    friend class dispatcher_t;
     struct request_params_t {
         target_id_t source_id;
         request_id_t request_id;
@@ -69,13 +80,25 @@ private:
 
     void note_send() const;
 
+    // Hands a suspended coroutine to this target's thread, see coro_t::migrate_to()
+    void send_migration(coro_t *coro);
+
+    // Requests carry the remaining time until the calling coroutine's deadline
+    static uint64_t request_deadline_ns();
+
     template <typename RPC, typename... Args>
     void send_request(target_id_t source_id, request_id_t request_id, Args &&...args) {
         typedef typename decltype(rpc_bridge(RPC::fn_ptr()))::write_t rpc_write_t;
-        stream()->write(rpc_write_t::make(source_id,
-                                          RPC::s_rpc_id,
-                                          request_id,
-                                          std::forward<Args>(args)...));
+        write_message_t msg = rpc_write_t::make(request_deadline_ns(),
+                                                source_id,
+                                                RPC::s_rpc_id,
+                                                request_id,
+                                                std::forward<Args>(args)...);
+        if (RPC::s_stealable) {
+            stream()->write_stealable(std::move(msg));
+        } else {
+            stream()->write(std::move(msg));
+        }
     }
 
     template <typename Res>
@@ -89,7 +112,11 @@ template <> void target_t::parse_result(read_message_t data);
 template <class stream_type>
 class local_target_t : public target_t {
 public:
-    local_target_t(stream_type *_stream) : m_stream(_stream) { }
+    explicit local_target_t(stream_type *_stream,
+                            thread_topology_t topology = thread_topology_t()) :
+            m_stream(_stream) {
+        m_topology = std::move(topology);
+    }
 
     bool is_local() const override final {
         return true;
@@ -1,35 +1,28 @@
 #ifndef SYNC_CORO_MAP_HPP_
 #define SYNC_CORO_MAP_HPP_
 
+#include <algorithm>
 #include <cstddef>
+#include <iterator>
 #include <type_traits>
 
 #include "coro/coro.hpp"
-#include "sync/drainer.hpp"
-#include "sync/semaphore.hpp"
 
 namespace indecorous {
 
+// Calls `cb` for each index or item in its own coroutine, returning when all
+// have finished - see coro_t::spawn_many
 template <typename callable_t>
 void coro_map(size_t start, size_t end, callable_t &&cb) {
     assert(start <= end);
-    drainer_t drainer;
-    for (size_t i = start; i < end; ++i) {
-        coro_t::spawn([&] (size_t inner_i, drainer_lock_t) {
-                cb(inner_i);
-            }, i, drainer.lock());
-    }
+    coro_t::spawn_many(start, end, [&] (size_t i) { cb(i); }).wait();
 }
 
 template <typename callable_t, typename iterable_t>
 typename std::enable_if<!std::is_integral<iterable_t>::value, void>::type
 coro_map(const iterable_t &iterable, callable_t &&cb) {
-    drainer_t drainer;
-    for (auto const &item : iterable) {
-        coro_t::spawn([&] (decltype(item) inner_item, drainer_lock_t) {
-                cb(inner_item);
-            }, item, drainer.lock());
-    }
+    typedef decltype(*std::begin(iterable)) item_t;
+    coro_t::spawn_many(iterable, [&] (item_t item) { cb(item); }).wait();
 }
 
 template <typename callable_t, typename count_t>
@@ -38,32 +31,32 @@ coro_map(count_t count, callable_t &&cb) {
     coro_map(0, static_cast<size_t>(count), std::forward<callable_t>(cb));
 }
 
+// As coro_map, but with at most `limit` calls running at once - this spawns
+// `limit` coroutines, which take indexes or items in order
 template <typename callable_t>
 void throttled_coro_map(size_t start, size_t end, callable_t &&cb, size_t limit) {
     assert(start <= end);
-    semaphore_t sem(limit);
-    drainer_t drainer;
-    for (size_t i = start; i < end; ++i) {
-        semaphore_acq_t acq = sem.start_acq(1);
-        acq.wait();
-        coro_t::spawn([&] (size_t inner_i, drainer_lock_t, semaphore_acq_t) {
-                cb(inner_i);
-            }, i, drainer.lock(), std::move(acq));
-    }
+    assert(limit > 0);
+    size_t next = start;
+    coro_t::spawn_many(0, std::min(limit, end - start), [&] (size_t) {
+            while (next < end) {
+                cb(next++);
+            }
+        }).wait();
 }
 
 template <typename callable_t, typename iterable_t>
 typename std::enable_if<!std::is_integral<iterable_t>::value, void>::type
 throttled_coro_map(const iterable_t &iterable, callable_t &&cb, size_t limit) {
-    semaphore_t sem(limit);
-    drainer_t drainer;
-    for (auto const &item : iterable) {
-        semaphore_acq_t acq = sem.start_acq(1);
-        acq.wait();
-        coro_t::spawn([&] (decltype(item) inner_item, drainer_lock_t, semaphore_acq_t) {
-                cb(inner_item);
-            }, item, drainer.lock(), std::move(acq));
-    }
+    assert(limit > 0);
+    auto next = std::begin(iterable);
+    auto end = std::end(iterable);
+    coro_t::spawn_many(0, limit, [&] (size_t) {
+            while (next != end) {
+                auto const &item = *next++;
+                cb(item);
+            }
+        }).wait();
 }
 
 template <typename callable_t, typename count_t>
@@ -73,7 +66,6 @@ throttled_coro_map(count_t count, callable_t &&cb, size_t limit) {
                        std::forward<callable_t>(cb), limit);
 }
 
-
 } // namespace indecorous
 
 #endif // SYNC_CORO_MAP_HPP_
@@ -67,10 +67,12 @@ void file_wait_t::file_callback(wait_result_t result) {
 }
 
 void file_wait_t::add_wait(wait_callback_t* cb) {
-    if (m_waiters.empty()) {
+    bool first = m_waiters.empty();
+    m_waiters.push_back(cb);
+    if (first) {
+        // This may call file_callback() right away
         m_thread_events->add_file_wait(this);
     }
-    m_waiters.push_back(cb);
 }
 
 void file_wait_t::remove_wait(wait_callback_t* cb) {
@@ -80,4 +82,23 @@ void file_wait_t::remove_wait(wait_callback_t* cb) {
     }
 }
 
+file_registration_t::file_registration_t(int _fd) :
+        m_fd(_fd),
+        m_thread_events(thread_t::self()->events()) {
+    m_thread_events->register_file(m_fd);
+}
+
+file_registration_t::file_registration_t(file_registration_t &&other) :
+        m_fd(other.m_fd),
+        m_thread_events(other.m_thread_events) {
+    other.m_fd = -1;
+    other.m_thread_events = nullptr;
+}
+
+file_registration_t::~file_registration_t() {
+    if (m_thread_events != nullptr) {
+        m_thread_events->unregister_file(m_fd);
+    }
+}
+
 } // namespace indecorous
@@ -42,6 +42,9 @@ public:
 private:
     void add_wait(wait_callback_t* cb) override final;
     void remove_wait(wait_callback_t* cb) override final;
+#if INDECOROUS_CORO_STATS
+    wait_category_t wait_category() const override final { return wait_category_t::FileWait; }
+#endif
 
     file_wait_t(int _fd, uint32_t _event_mask);
 
@@ -53,6 +56,22 @@ private:
     DISABLE_COPYING(file_wait_t);
 };
 
+// Keeps an fd registered with the current thread's events_t, so that waits on
+// it are edge-triggered and need no epoll_ctl calls - see
+// events_t::register_file().  This must be destroyed before the fd is closed.
+class file_registration_t {
+public:
+    explicit file_registration_t(int _fd);
+    file_registration_t(file_registration_t &&other);
+    ~file_registration_t();
+
+private:
+    int m_fd;
+    events_t *m_thread_events;
+
+    DISABLE_COPYING(file_registration_t);
+};
+
 } // namespace indecorous
 
 #endif
@@ -2,12 +2,13 @@
 
 #include "common.hpp"
 #include "coro/coro.hpp"
+#include "coro/thread.hpp"
 
 namespace indecorous {
 
 interruptor_t::interruptor_t(waitable_t *waitable) :
         m_triggered(false),
-        m_waitable(waitable), m_waiters(),
+        m_waitable(waitable), m_home(thread_t::self()), m_waiters(),
         m_prev_waiter(this, coro_t::self()->add_interruptor(this)) {
     m_waitable->add_wait(this);
 }
@@ -15,7 +16,7 @@ interruptor_t::interruptor_t(waitable_t *waitable) :
 // Constructor used when inheriting interruptors from the parent coroutine
 interruptor_t::interruptor_t(interruptor_t *parent_interruptor) :
         m_triggered(false),
-        m_waitable(nullptr), m_waiters(),
+        m_waitable(nullptr), m_home(thread_t::self()), m_waiters(),
         m_prev_waiter(this, parent_interruptor) {
    DEBUG_VAR interruptor_t *prev_interruptor = coro_t::self()->add_interruptor(this);
    assert(prev_interruptor == nullptr);
@@ -26,6 +27,7 @@ interruptor_t::interruptor_t(interruptor_t &&other) :
         intrusive_node_t<interruptor_t>(std::move(other)),
         m_triggered(other.m_triggered),
         m_waitable(other.m_waitable),
+        m_home(other.m_home),
         m_waiters(std::move(other.m_waiters)),
         m_prev_waiter(std::move(other.m_prev_waiter)) {
     other.m_triggered = false;
@@ -46,6 +48,23 @@ bool interruptor_t::triggered() const {
     return m_triggered;
 }
 
+void interruptor_t::suspend() {
+    // An inherited interruptor is chained to the parent coroutine's, which
+    // stays on this thread and would notify us there
+    GUARANTEE(m_waitable != nullptr);
+    if (intrusive_node_t<wait_callback_t>::in_a_list()) {
+        m_waitable->remove_wait(this);
+    }
+}
+
+void interruptor_t::resume() {
+    if (!m_triggered && m_waitable != nullptr && m_home == thread_t::self() &&
+        !intrusive_node_t<wait_callback_t>::in_a_list()) {
+        // This triggers immediately if the waitable fired while we were away
+        m_waitable->add_wait(this);
+    }
+}
+
 void interruptor_t::add_wait(wait_callback_t *cb) {
     if (m_triggered) {
         cb->wait_done(wait_result_t::Interrupted);
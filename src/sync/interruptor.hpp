@@ -7,6 +7,7 @@
 
 namespace indecorous {
 
+class thread_t;
 class waitable_t;
 
 class interruptor_t final : public waitable_t,
@@ -21,6 +22,14 @@ public:
     bool triggered() const;
 
 private:
+    // Used by coro_t::migrate_to() - a suspended interruptor stops listening to
+    // its waitable, and only resumes on the thread it was created on.  Links to
+    // earlier interruptors on the same coroutine are kept, but an inherited
+    // interruptor cannot be suspended.
+    friend class coro_t;
+    void suspend();
+    void resume();
+
     // waitable_t implementation - called by interruptors down the chain or by a coroutine wait
     void add_wait(wait_callback_t *cb) override final;
     void remove_wait(wait_callback_t *cb) override final;
@@ -51,6 +60,7 @@ private:
 
     bool m_triggered;
     waitable_t *m_waitable;
+    thread_t *m_home;
     intrusive_list_t<wait_callback_t> m_waiters;
     prev_waiter_t m_prev_waiter;
 
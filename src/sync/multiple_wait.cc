@@ -32,6 +32,22 @@ void multiple_waiter_t::wait() {
 
     // We may be immediately ready
     if (!m_ready) {
+#if INDECOROUS_CORO_STATS
+        // Interruptors and other uncategorised objects are left out, and a wait
+        // on objects of different categories can't be attributed to any one
+        wait_category_t category = wait_category_t::Other;
+        bool mixed = false;
+        m_items.each([&] (auto cb) {
+                wait_category_t item_category = cb->category();
+                if (item_category != wait_category_t::Other) {
+                    if (category != wait_category_t::Other && category != item_category) {
+                        mixed = true;
+                    }
+                    category = item_category;
+                }
+            });
+        m_owner_coro->note_wait_category(mixed ? wait_category_t::Other : category);
+#endif
         m_waiting = true;
         m_owner_coro->wait();
     } else {
@@ -109,6 +125,12 @@ void multiple_wait_callback_t::cancel_wait() {
     }
 }
 
+#if INDECOROUS_CORO_STATS
+wait_category_t multiple_wait_callback_t::category() const {
+    return m_obj->wait_category();
+}
+#endif
+
 void multiple_wait_callback_t::wait_done(wait_result_t result) {
     m_waiter->item_finished(result);
 }
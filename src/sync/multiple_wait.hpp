@@ -58,6 +58,10 @@ public:
     void begin_wait();
     void cancel_wait();
 
+#if INDECOROUS_CORO_STATS
+    wait_category_t category() const;
+#endif
+
 private:
     void wait_done(wait_result_t result) override final;
     void object_moved(waitable_t *new_ptr) override final;
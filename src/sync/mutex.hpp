@@ -23,6 +23,9 @@ private:
 
     void add_wait(wait_callback_t *cb) override final;
     void remove_wait(wait_callback_t *cb) override final;
+#if INDECOROUS_CORO_STATS
+    wait_category_t wait_category() const override final { return wait_category_t::Mutex; }
+#endif
 
     mutex_t *m_parent;
     intrusive_list_t<wait_callback_t> m_waiters;
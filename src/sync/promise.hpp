@@ -13,6 +13,7 @@ template <typename T> class promise_data_t;
 template <> class promise_data_t<void>;
 
 template <typename T> class future_t;
+template <typename T> class task_future_wait_t;
 
 template <typename T>
 struct future_reducer_t {
@@ -60,6 +61,7 @@ public:
 
 private:
     friend class promise_data_t<T>;
+    friend class task_future_wait_t<T>; // Reads the value without blocking
     explicit future_t(promise_data_t<T> *data);
 
     void add_wait(wait_callback_t *cb) override final;
@@ -58,6 +58,9 @@ private:
 
     void add_wait(wait_callback_t *cb) override final;
     void remove_wait(wait_callback_t *cb) override final;
+#if INDECOROUS_CORO_STATS
+    wait_category_t wait_category() const override final { return wait_category_t::Semaphore; }
+#endif
 
     semaphore_t *m_parent;
     size_t m_owned;
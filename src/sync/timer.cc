@@ -53,17 +53,25 @@ int64_t absolute_time_t::ms_diff(const absolute_time_t &a, const absolute_time_t
     return (s_diff * 1000) + (ns_diff / 1000000) + ((ns_diff % 1000000 > 0) ? 1 : 0);
 }
 
+uint64_t absolute_time_t::ms_rounded_up() const {
+    return (sec * 1000) + ((nsec + 999999) / 1000000);
+}
+
 bool absolute_time_t::operator < (const absolute_time_t &other) const {
     return (sec < other.sec) ? true : ((sec == other.sec) ? (nsec < other.nsec) : false);
 }
 
 // TODO: timers are incomplete, especially this object
 timer_callback_t::timer_callback_t() :
-    m_timeout() { }
+    m_timeout(),
+    m_expiry_ms(0),
+    m_wheel_position(0) { }
 
 timer_callback_t::timer_callback_t(timer_callback_t &&other) :
     intrusive_node_t<timer_callback_t>(std::move(other)),
-    m_timeout(other.m_timeout) { }
+    m_timeout(other.m_timeout),
+    m_expiry_ms(other.m_expiry_ms),
+    m_wheel_position(other.m_wheel_position) { }
 
 const absolute_time_t &timer_callback_t::timeout() const {
     return m_timeout;
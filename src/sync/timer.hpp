@@ -23,6 +23,9 @@ public:
     // Add delta_ms to the absolute time until it is in the future
     void update_periodic(int64_t delta_ms);
 
+    // Milliseconds on the monotonic clock, rounded up
+    uint64_t ms_rounded_up() const;
+
     absolute_time_t &operator = (const absolute_time_t &other);
     bool operator < (const absolute_time_t &other) const;
 private:
@@ -42,6 +45,11 @@ public:
 protected:
     absolute_time_t m_timeout;
 private:
+    // Only valid while in a timer_wheel_t
+    friend class timer_wheel_t;
+    uint64_t m_expiry_ms;
+    uint32_t m_wheel_position;
+
     DISABLE_COPYING(timer_callback_t);
 };
 
@@ -58,6 +66,9 @@ public:
 private:
     void add_wait(wait_callback_t* cb) override final;
     void remove_wait(wait_callback_t* cb) override final;
+#if INDECOROUS_CORO_STATS
+    wait_category_t wait_category() const override final { return wait_category_t::Timer; }
+#endif
     void timer_callback(wait_result_t result) override final;
 
     bool m_triggered;
@@ -80,6 +91,9 @@ public:
 private:
     void add_wait(wait_callback_t* cb) override final;
     void remove_wait(wait_callback_t* cb) override final;
+#if INDECOROUS_CORO_STATS
+    wait_category_t wait_category() const override final { return wait_category_t::Timer; }
+#endif
     void timer_callback(wait_result_t result) override final;
 
     void stop_internal(wait_result_t result);
@@ -18,6 +18,26 @@ const char *wait_result_str(wait_result_t res) {
     }
 }
 
+const char *wait_category_str(wait_category_t category) {
+    switch (category) {
+    case wait_category_t::Timer:
+        return "Timer";
+    case wait_category_t::FileWait:
+        return "FileWait";
+    case wait_category_t::Mutex:
+        return "Mutex";
+    case wait_category_t::Semaphore:
+        return "Semaphore";
+    case wait_category_t::RpcReply:
+        return "RpcReply";
+    case wait_category_t::Yield:
+        return "Yield";
+    case wait_category_t::Other:
+        return "Other";
+    default: UNREACHABLE();
+    }
+}
+
 // If a wait failed, throw an appropriate exception so the user can handle it
 void check_wait_result(wait_result_t result) {
     switch (result) {
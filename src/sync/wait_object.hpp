@@ -1,6 +1,9 @@
 #ifndef SYNC_WAIT_OBJECT_HPP_
 #define SYNC_WAIT_OBJECT_HPP_
 
+#include <cstddef>
+
+#include "common.hpp"
 #include "containers/intrusive.hpp"
 
 namespace indecorous {
@@ -16,6 +19,21 @@ enum class wait_result_t {
 const char *wait_result_str(wait_result_t res);
 void check_wait_result(wait_result_t result);
 
+// What a coroutine was blocked on, for accounting in coro_stats_t
+enum class wait_category_t {
+    Timer,
+    FileWait,
+    Mutex,
+    Semaphore,
+    RpcReply,
+    Yield,
+    Other,
+};
+
+const size_t num_wait_categories = 7;
+
+const char *wait_category_str(wait_category_t category);
+
 class wait_callback_t : public intrusive_node_t<wait_callback_t> {
 public:
     wait_callback_t() = default;
@@ -32,6 +50,10 @@ public:
     virtual void add_wait(wait_callback_t* waiter) = 0;
     virtual void remove_wait(wait_callback_t* waiter) = 0;
 
+#if INDECOROUS_CORO_STATS
+    virtual wait_category_t wait_category() const { return wait_category_t::Other; }
+#endif
+
     void wait();
 };
 
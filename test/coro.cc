@@ -1,17 +1,33 @@
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <vector>
+
 #include "test.hpp"
 
+#include "coro/busy_poll.hpp"
 #include "coro/coro.hpp"
+#include "coro/cycle_clock.hpp"
+#include "coro/local.hpp"
 #include "coro/sched.hpp"
+#include "coro/stack_pool.hpp"
+#include "coro/thread.hpp"
+#include "coro/topology.hpp"
+#include "coro/watchdog.hpp"
 #include "errors.hpp"
 #include "rpc/handler.hpp"
 #include "rpc/target.hpp"
 #include "rpc/serialize_stl.hpp"
+#include "sync/event.hpp"
+#include "sync/interruptor.hpp"
 #include "sync/timer.hpp"
 #include "sync/multiple_wait.hpp"
 
@@ -25,9 +41,28 @@ struct coro_test_t {
     DECLARE_STATIC_RPC(log)(std::string, std::string, int) -> void;
     DECLARE_STATIC_RPC(wait)() -> void;
     DECLARE_STATIC_RPC(suicide)(pid_t parent_pid, int signum) -> void;
+    DECLARE_STATIC_RPC(high_priority, priority_t::High)() -> void;
+    DECLARE_STATIC_RPC(spin_then_sleep)(uint64_t spin_ns, int64_t sleep_ms) -> void;
+    DECLARE_STATIC_RPC(deadline_remaining_ns)() -> uint64_t;
+    DECLARE_STATIC_RPC(migrate)() -> void;
+    DECLARE_STATIC_RPC(stall)() -> void;
+    DECLARE_STATIC_RPC(check_affinity)() -> void;
+    DECLARE_STATIC_RPC(echo)(uint64_t) -> uint64_t;
+    DECLARE_STATIC_RPC(ping_peer)() -> void;
+    DECLARE_STATIC_RPC(resize_pool)() -> void;
+    DECLARE_STATIC_RPC(is_parked)() -> bool;
+    DECLARE_STATIC_RPC(num_local_targets)() -> uint64_t;
+    DECLARE_STATIC_RPC(relay)(uint64_t hops) -> void;
+    DECLARE_STATIC_RPC(busy)(uint64_t spin_ns) -> void;
+    DECLARE_STATIC_RPC(call_any)() -> void;
+
+    static scheduler_t *sched;
+    static std::atomic<bool> busy_started;
 };
 
 std::atomic<uint64_t> coro_test_t::count(0);
+scheduler_t *coro_test_t::sched = nullptr;
+std::atomic<bool> coro_test_t::busy_started(false);
 
 IMPL_STATIC_RPC(coro_test_t::log)(std::string a, std::string b, int value) -> void {
     logDebug("Got called with %s, %s, %d", a.c_str(), b.c_str(), value);
@@ -49,6 +84,23 @@ IMPL_STATIC_RPC(coro_test_t::suicide)(pid_t parent_pid, int signum) -> void {
     kill(parent_pid, signum);
 }
 
+IMPL_STATIC_RPC(coro_test_t::high_priority)() -> void {
+    CHECK(coro_t::self()->priority() == priority_t::High);
+    coro_t::spawn([] { CHECK(coro_t::self()->priority() == priority_t::High); }).wait();
+    count += 1;
+}
+
+IMPL_STATIC_RPC(coro_test_t::spin_then_sleep)(uint64_t spin_ns, int64_t sleep_ms) -> void {
+    uint64_t start = cycle_clock_t::now();
+    while (cycle_clock_t::to_ns(cycle_clock_t::now() - start) < spin_ns) { }
+    single_timer_t timer(sleep_ms);
+    timer.wait();
+}
+
+IMPL_STATIC_RPC(coro_test_t::deadline_remaining_ns)() -> uint64_t {
+    return coro_t::self()->deadline().remaining_ns();
+}
+
 TEST_CASE("coro/none", "[coro][shutdown]") {
     for (size_t i = 1; i < 16; ++i) {
         scheduler_t sched(i, shutdown_policy_t::Eager);
@@ -427,3 +479,875 @@ SIMPLE_TEST(coro, spawn_params, 2, "[coro][spawn_params]") {
         CHECK(param.get() == 1);
     }
 }
+
+// Touches roughly `depth` KiB of stack
+size_t recurse_stack(size_t depth) {
+    volatile char buffer[1024];
+    buffer[0] = static_cast<char>(depth);
+    return (depth == 0) ? buffer[0] : recurse_stack(depth - 1) + buffer[0];
+}
+
+SIMPLE_TEST(coro, lazy_stack, 1, "[coro][lazy_stack]") {
+    coro_cache_t *cache = &thread_t::self()->dispatcher()->m_coro_cache;
+    size_t initial_bytes = cache->resident_stack_bytes();
+
+    coro_result_t<size_t> res = coro_t::spawn([&] {
+            size_t deep = recurse_stack(256);
+            CHECK(cache->resident_stack_bytes() >= initial_bytes + 256 * 1024);
+            return deep;
+        });
+    res.wait();
+
+    // The grown stack is trimmed when the coroutine is returned to the cache
+    coro_t::yield();
+    CHECK(cache->resident_stack_bytes() < initial_bytes + 64 * 1024);
+}
+
+SIMPLE_TEST(coro, lazy_stack_params, 1, "[coro][lazy_stack]") {
+    // Spawn parameters bigger than the committed stack are written by the parent
+    std::array<char, 64 * 1024> big;
+    big.fill('x');
+    char res = coro_t::spawn([] (const std::array<char, 64 * 1024> &a) {
+            return a[0];
+        }, big).release();
+    CHECK(res == 'x');
+}
+
+SIMPLE_TEST(coro, lazy_stack_syscall, 1, "[coro][lazy_stack]") {
+    // The kernel does not commit stack memory for us, so a read into a part of
+    // the stack the coroutine never touched fails
+    int fds[2];
+    REQUIRE(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0);
+    GUARANTEE_ERR(::write(fds[1], "ab", 2) == 2);
+    coro_t::spawn([&] {
+            char marker = 0;
+            char *deep = reinterpret_cast<char *>(reinterpret_cast<uintptr_t>(&marker) - 128 * 1024);
+            ssize_t res = ::read(fds[0], deep, 1);
+            int err = errno;
+            CHECK(res == -1);
+            CHECK(err == EFAULT);
+
+            *reinterpret_cast<volatile char *>(deep) = 0;
+            res = ::read(fds[0], deep, 1);
+            CHECK(res == 1);
+        }).wait();
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+// A fault the stack fault handler doesn't own, fixed up by the test's handler
+static char *foreign_page = nullptr;
+static size_t foreign_faults = 0;
+
+void foreign_fault_handler(int, siginfo_t *info, void *) {
+    GUARANTEE(info->si_addr == foreign_page);
+    GUARANTEE_ERR(mprotect(foreign_page, ::sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE) == 0);
+    ++foreign_faults;
+}
+
+struct foreign_fault_test_t {
+    DECLARE_STATIC_RPC(fault)() -> void;
+};
+
+IMPL_STATIC_RPC(foreign_fault_test_t::fault)() -> void {
+    for (size_t i = 0; i < 2; ++i) {
+        GUARANTEE_ERR(mprotect(foreign_page, ::sysconf(_SC_PAGESIZE), PROT_NONE) == 0);
+        *reinterpret_cast<volatile char *>(foreign_page) = 'x';
+
+        // Stack faults are still ours after passing one on
+        size_t deep = coro_t::spawn([] { return recurse_stack(256); }).release();
+        CHECK(deep > 0u);
+    }
+    CHECK(foreign_faults == 2u);
+}
+
+TEST_CASE("coro/foreign_fault", "[coro][lazy_stack]") {
+    size_t page_size = ::sysconf(_SC_PAGESIZE);
+    void *page = mmap(nullptr, page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    REQUIRE(page != MAP_FAILED);
+    foreign_page = reinterpret_cast<char *>(page);
+
+    struct sigaction sigact;
+    struct sigaction old_sigact;
+    memset(&sigact, 0, sizeof(sigact));
+    sigact.sa_flags = SA_SIGINFO;
+    sigact.sa_sigaction = &foreign_fault_handler;
+    sigemptyset(&sigact.sa_mask);
+    REQUIRE(sigaction(SIGSEGV, &sigact, &old_sigact) == 0);
+    {
+        scheduler_t sched(1, shutdown_policy_t::Eager);
+        sched.broadcast_local<foreign_fault_test_t::fault>();
+        sched.run();
+    }
+    REQUIRE(sigaction(SIGSEGV, &old_sigact, nullptr) == 0);
+    REQUIRE(munmap(page, page_size) == 0);
+}
+
+#if INDECOROUS_STACK_STATS
+SIMPLE_TEST(coro, stack_stats, 1, "[coro][stack_stats]") {
+    coro_cache_t *cache = &thread_t::self()->dispatcher()->m_coro_cache;
+    uint64_t initial_samples = cache->stack_depths().samples;
+
+    // Run the same lambda deep and then shallow, the canary must be refilled between runs
+    auto fn = [] (size_t depth) { return recurse_stack(depth); };
+    coro_t::spawn(fn, 128).wait();
+    coro_t::yield(); // The coroutine is released on the next swap
+    auto const &sites = cache->stack_depths_by_site();
+    auto it = sites.find(spawn_site_name<decltype(fn)>());
+    REQUIRE(it != sites.end());
+    CHECK(it->second.samples == 1);
+    CHECK(it->second.max_depth >= 128 * 1024);
+    CHECK(it->second.max_depth < 256 * 1024);
+
+    coro_t::spawn(fn, 1).wait();
+    coro_t::yield();
+    CHECK(it->second.samples == 2);
+    uint64_t shallow = it->second.buckets[0] + it->second.buckets[1] + it->second.buckets[2];
+    CHECK(shallow == 1);
+    CHECK(cache->stack_depths().samples >= initial_samples + 2);
+
+    thread_t::self()->hub()->broadcast_local_sync<coro_test_t::spin_then_sleep>(uint64_t(0), int64_t(0));
+    coro_t::yield();
+    auto const &rpcs = thread_t::self()->hub()->rpc_stack_depths();
+    auto rpc_it = rpcs.find(coro_test_t::spin_then_sleep::s_rpc_id);
+    REQUIRE(rpc_it != rpcs.end());
+    CHECK(rpc_it->second.samples == 1);
+}
+#endif
+
+SIMPLE_TEST(coro, stack_class, 1, "[coro][stack_class]") {
+    coro_cache_t *cache = &thread_t::self()->dispatcher()->m_coro_cache;
+
+    // Small stacks commit less up front than large ones
+    size_t initial_bytes = cache->resident_stack_bytes();
+    coro_result_t<void> small = coro_t::spawn(stack_class_t::Small, [] { });
+    size_t small_bytes = cache->resident_stack_bytes() - initial_bytes;
+    coro_result_t<void> large = coro_t::spawn(stack_class_t::Large, [] { });
+    size_t large_bytes = cache->resident_stack_bytes() - initial_bytes - small_bytes;
+    CHECK(small_bytes > 0);
+    CHECK(small_bytes < large_bytes);
+    small.wait();
+    large.wait();
+
+    // Large stacks can go deeper than the default stack size
+    coro_result_t<size_t> deep = coro_t::spawn_now(stack_class_t::Large, &recurse_stack, 2048);
+    deep.wait();
+
+    size_t detached_count = 0;
+    coro_t::spawn_detached(stack_class_t::Small, [&] { ++detached_count; });
+    coro_t::yield();
+    CHECK(detached_count == 1);
+}
+
+// Counts the resident pages in [begin, end)
+size_t resident_pages(char *begin, char *end) {
+    size_t page_size = ::sysconf(_SC_PAGESIZE);
+    uintptr_t aligned = reinterpret_cast<uintptr_t>(begin) & ~(page_size - 1);
+    size_t num_pages = (reinterpret_cast<uintptr_t>(end) - aligned) / page_size;
+    std::vector<unsigned char> pages(num_pages);
+    GUARANTEE_ERR(mincore(reinterpret_cast<void *>(aligned), num_pages * page_size, pages.data()) == 0);
+    return std::count_if(pages.begin(), pages.end(), [] (unsigned char p) { return (p & 1) != 0; });
+}
+
+SIMPLE_TEST(coro, compact_stack, 1, "[coro][stack_class]") {
+    // Each coroutine goes deep, then blocks - only the live part of a compact
+    // stack stays resident while it is blocked
+    event_t event;
+    auto fn = [&] (char **live) {
+        char marker = 'x';
+        *live = &marker;
+        recurse_stack(32);
+        event.wait();
+        return marker;
+    };
+
+#if !INDECOROUS_STACK_STATS
+    coro_cache_t *cache = &thread_t::self()->dispatcher()->m_coro_cache;
+    size_t initial_bytes = cache->resident_stack_bytes();
+#endif
+    char *compact_live = nullptr;
+    char *small_live = nullptr;
+    coro_result_t<char> compact = coro_t::spawn(stack_class_t::Compact, fn, &compact_live);
+    coro_result_t<char> small = coro_t::spawn(stack_class_t::Small, fn, &small_live);
+    std::vector<coro_result_t<char> > many;
+    std::vector<char *> many_live(1000);
+    for (size_t i = 0; i < many_live.size(); ++i) {
+        many.emplace_back(coro_t::spawn(stack_class_t::Compact, fn, &many_live[i]));
+    }
+    coro_t::yield();
+
+    const size_t depth = 24 * 1024;
+#if !INDECOROUS_STACK_STATS
+    CHECK(resident_pages(compact_live - depth, compact_live - 8 * 1024) == 0);
+
+    // Only the live pages of the blocked compact stacks are counted
+    size_t stack_bytes = cache->resident_stack_bytes() - initial_bytes;
+    CHECK(stack_bytes < 64 * 1024 + (many.size() + 1) * 16 * 1024);
+#endif
+    CHECK(resident_pages(small_live - depth, small_live - 8 * 1024) > 0);
+
+    event.set();
+    CHECK(compact.release() == 'x');
+    CHECK(small.release() == 'x');
+    for (auto &&res : many) {
+        CHECK(res.release() == 'x');
+    }
+}
+
+SIMPLE_TEST(coro, stack_pool, 1, "[coro][stack_class]") {
+    // More coroutines at once than the thread's cache holds, the rest are
+    // spilled to the stack pool when they finish
+    auto run_batch = [] {
+        event_t event;
+        std::vector<coro_result_t<void> > results;
+        for (size_t i = 0; i < 128; ++i) {
+            results.emplace_back(coro_t::spawn(stack_class_t::Small, [&] { event.wait(); }));
+        }
+        coro_t::yield();
+        event.set();
+        wait_all(results);
+        coro_t::yield(); // The last coroutine is released on the next swap
+    };
+
+    run_batch();
+    stack_pool_t::stats_t before = stack_pool_t::instance()->stats();
+    run_batch();
+    stack_pool_t::stats_t after = stack_pool_t::instance()->stats();
+    CHECK(after.hits > before.hits);
+    // Other threads may map stacks of their own meanwhile
+    CHECK(after.maps < before.maps + 32);
+    CHECK(after.hit_rate() > 0.0);
+}
+
+SIMPLE_TEST(coro, spawn_many, 1, "[coro][spawn_many]") {
+    // Queued together, in order, and behind what was already queued
+    std::vector<size_t> order;
+    coro_result_t<void> before = coro_t::spawn([&] { order.push_back(0); });
+    coro_batch_t batch = coro_t::spawn_many(1, 5, [&] (size_t i) { order.push_back(i); });
+    CHECK(batch.remaining() == 4);
+    batch.wait();
+    CHECK(batch.remaining() == 0);
+    CHECK(order == std::vector<size_t>({ 0, 1, 2, 3, 4 }));
+    before.wait();
+
+    std::vector<std::string> items({ "a", "b", "c" });
+    std::string joined;
+    coro_t::spawn_many(items, [&] (const std::string &item) { joined += item; }).wait();
+    CHECK(joined == "abc");
+
+    // Options apply to every coroutine
+    size_t high = 0;
+    coro_t::spawn_many(priority_t::High, 0, 3, [&] (size_t) {
+            high += (coro_t::self()->priority() == priority_t::High) ? 1 : 0;
+        }).wait();
+    CHECK(high == 3);
+
+    // Destroying the batch interrupts the coroutines still running
+    event_t never;
+    size_t interrupted = 0;
+    {
+        coro_batch_t waiting = coro_t::spawn_many(0, 10, [&] (size_t) {
+                try {
+                    never.wait();
+                } catch (const wait_interrupted_exc_t &) {
+                    ++interrupted;
+                }
+            });
+        coro_t::yield();
+        CHECK(waiting.remaining() == 10);
+    }
+    CHECK(interrupted == 10);
+}
+
+SIMPLE_TEST(coro, priority, 1, "[coro][priority]") {
+    CHECK(coro_t::self()->priority() == priority_t::Normal);
+
+    std::vector<priority_t> order;
+    auto note = [&] { order.push_back(coro_t::self()->priority()); };
+    coro_result_t<void> low = coro_t::spawn(priority_t::Low, note);
+    coro_result_t<void> normal = coro_t::spawn(note);
+    coro_result_t<void> high = coro_t::spawn(spawn_options_t(stack_class_t::Small, priority_t::High), note);
+    low.wait();
+    normal.wait();
+    high.wait();
+    REQUIRE(order.size() == 3);
+    CHECK(order[0] == priority_t::High);
+    CHECK(order[1] == priority_t::Normal);
+    CHECK(order[2] == priority_t::Low);
+
+    // Children inherit their parent's priority unless told otherwise
+    coro_t::spawn(priority_t::Low, [] {
+            CHECK(coro_t::spawn([] { return coro_t::self()->priority(); }).release() == priority_t::Low);
+            CHECK(coro_t::spawn(priority_t::High, [] { return coro_t::self()->priority(); }).release() == priority_t::High);
+        }).wait();
+}
+
+SIMPLE_TEST(coro, starvation, 1, "[coro][priority]") {
+    // A busy high-priority coroutine should not stop a low-priority one from running
+    size_t high_yields = 0;
+    bool low_done = false;
+    coro_result_t<void> low = coro_t::spawn(priority_t::Low, [&] { low_done = true; });
+    coro_result_t<void> high = coro_t::spawn(priority_t::High, [&] {
+            while (!low_done && high_yields < 1000) {
+                ++high_yields;
+                coro_t::yield();
+            }
+        });
+    high.wait();
+    low.wait();
+    CHECK(low_done);
+    CHECK(high_yields < 100);
+}
+
+SIMPLE_TEST(coro, time_slice, 1, "[coro][time_slice]") {
+    // With a short loop latency, CPU-heavy coroutines should not keep the
+    // dispatcher from polling between each of their slices
+    const size_t slices = 10;
+    const uint64_t slice_ns = 200 * 1000;
+    uint64_t old_latency = dispatcher_t::s_target_loop_latency_ns.exchange(slice_ns / 2);
+    dispatcher_t *dispatch = thread_t::self()->dispatcher();
+    dispatcher_t::loop_stats_t before = dispatch->loop_stats();
+
+    auto busy = [&] {
+        for (size_t i = 0; i < slices; ++i) {
+            uint64_t start = cycle_clock_t::now();
+            while (cycle_clock_t::to_ns(cycle_clock_t::now() - start) < slice_ns) { }
+            coro_t::yield();
+        }
+    };
+    coro_result_t<void> a = coro_t::spawn(busy);
+    coro_result_t<void> b = coro_t::spawn(busy);
+    a.wait();
+    b.wait();
+
+    dispatcher_t::loop_stats_t after = dispatch->loop_stats();
+    uint64_t iterations = after.iterations - before.iterations;
+    uint64_t run_ns = after.run_ns - before.run_ns;
+    CHECK(iterations >= slices);
+    CHECK(run_ns >= slices * 2 * slice_ns);
+    CHECK(after.poll_ns > before.poll_ns);
+    dispatcher_t::s_target_loop_latency_ns.store(old_latency);
+}
+
+static coro_local_t<std::string> tenant_local(coro_local_inherit_t::Yes);
+static coro_local_t<size_t> depth_local;
+
+SIMPLE_TEST(coro, local, 1, "[coro][local]") {
+    CHECK(tenant_local.get() == nullptr);
+    CHECK(coro_t::spawn([] { return tenant_local.get() == nullptr; }).release());
+
+    tenant_local.set("tenant");
+    depth_local.set(1);
+    REQUIRE(tenant_local.get() != nullptr);
+    CHECK(*tenant_local.get() == "tenant");
+
+    // Values are per-coroutine, even across swaps
+    coro_result_t<void> other = coro_t::spawn([] {
+            CHECK(depth_local.get() == nullptr);
+            depth_local.set(2);
+            coro_t::yield();
+            CHECK(*depth_local.get() == 2);
+        });
+    coro_t::yield();
+    CHECK(*depth_local.get() == 1);
+    other.wait();
+
+    // Only inheritable slots are copied to children, and the copy is separate
+    coro_t::spawn([] {
+            REQUIRE(tenant_local.get() != nullptr);
+            CHECK(*tenant_local.get() == "tenant");
+            CHECK(depth_local.get() == nullptr);
+            tenant_local.set("child");
+        }).wait();
+    CHECK(*tenant_local.get() == "tenant");
+
+    tenant_local.reset();
+    depth_local.reset();
+    CHECK(tenant_local.get() == nullptr);
+    CHECK(coro_t::self()->locals()->empty());
+}
+
+#if INDECOROUS_CORO_STATS
+SIMPLE_TEST(coro, stats, 1, "[coro][stats]") {
+    const uint64_t spin_ns = 5 * 1000 * 1000;
+    const int64_t sleep_ms = 20;
+    thread_t::self()->hub()->broadcast_local_sync<coro_test_t::spin_then_sleep>(uint64_t(spin_ns), int64_t(sleep_ms));
+
+    auto const &all_stats = thread_t::self()->hub()->rpc_stats();
+    auto it = all_stats.find(coro_test_t::spin_then_sleep::s_rpc_id);
+    REQUIRE(it != all_stats.end());
+    CHECK(it->second.calls == 1);
+    CHECK(it->second.time.run_ns >= spin_ns);
+    CHECK(it->second.time.wait_ns[static_cast<size_t>(wait_category_t::Timer)] >= (sleep_ms - 1) * 1000 * 1000);
+
+    // The caller's wait is attributed to the reply rather than the future
+    coro_stats_t self_stats = coro_t::self()->stats();
+    CHECK(self_stats.wait_ns[static_cast<size_t>(wait_category_t::RpcReply)] >= (sleep_ms - 1) * 1000 * 1000);
+    CHECK(self_stats.wait_ns[static_cast<size_t>(wait_category_t::Other)] < 1000 * 1000);
+
+    // A wait that can be interrupted is still attributed to what it waits on
+    event_t never;
+    interruptor_t interruptor(&never);
+    single_timer_t timer(sleep_ms);
+    wait_any(timer, interruptor);
+    uint64_t timer_ns = coro_t::self()->stats().wait_ns[static_cast<size_t>(wait_category_t::Timer)] -
+        self_stats.wait_ns[static_cast<size_t>(wait_category_t::Timer)];
+    CHECK(timer_ns >= (sleep_ms - 1) * 1000 * 1000);
+}
+#endif
+
+SIMPLE_TEST(coro, deadline, 1, "[coro][deadline]") {
+    // Earliest deadline first, then coroutines without a deadline in FIFO order
+    std::vector<int> order;
+    std::vector<coro_result_t<void> > results;
+    results.emplace_back(coro_t::spawn([&] { order.push_back(0); }));
+    results.emplace_back(coro_t::spawn(deadline_t::in_ms(2000), [&] { order.push_back(2); }));
+    results.emplace_back(coro_t::spawn(deadline_t::in_ms(1000), [&] { order.push_back(1); }));
+    results.emplace_back(coro_t::spawn([&] { order.push_back(3); }));
+    wait_all(results);
+    REQUIRE(order.size() == 4);
+    CHECK(order[0] == 1);
+    CHECK(order[1] == 2);
+    CHECK(order[2] == 0);
+    CHECK(order[3] == 3);
+
+    // Only coroutines given a deadline count as misses, not children inheriting it
+    dispatcher_t *dispatch = thread_t::self()->dispatcher();
+    uint64_t misses = dispatch->deadline_misses();
+    coro_t::spawn(deadline_t::in_ns(0), [] {
+            CHECK(coro_t::self()->deadline().passed());
+            coro_t::spawn([] { CHECK(coro_t::self()->deadline().is_set()); }).wait();
+        }).wait();
+    coro_t::yield();
+    CHECK(dispatch->deadline_misses() == misses + 1);
+
+    // Deadlines are sent along with RPCs
+    CHECK(thread_t::self()->target()->call_sync<coro_test_t::deadline_remaining_ns>() == 0);
+    uint64_t remaining = coro_t::spawn(deadline_t::in_ms(1000), [] {
+            return thread_t::self()->target()->call_sync<coro_test_t::deadline_remaining_ns>();
+        }).release();
+    CHECK(remaining > 500 * 1000 * 1000);
+    CHECK(remaining <= 1000 * 1000 * 1000);
+    CHECK(dispatch->deadline_misses() == misses + 1);
+}
+
+IMPL_STATIC_RPC(coro_test_t::migrate)() -> void {
+    thread_t *home = thread_t::self();
+    target_t *other = nullptr;
+    for (target_t *t : home->hub()->local_targets()) {
+        if (t != home->target()) {
+            other = t;
+        }
+    }
+    REQUIRE(other != nullptr);
+
+    coro_t::migrate_to(home->target());
+    CHECK(thread_t::self() == home);
+
+    // The event is set at home while we are away, the interruptor only notices
+    // once we are back
+    event_t event;
+    coro_result_t<void> setter = coro_t::spawn([&] { event.set(); });
+    thread_t *away = nullptr;
+    {
+        interruptor_t interruptor(&event);
+        coro_t::migrate_to(other);
+        away = thread_t::self();
+        CHECK(away != home);
+        CHECK(coro_t::spawn([] { return thread_t::self(); }).release() == away);
+        single_timer_t timer;
+        timer.start(10);
+        timer.wait();
+        CHECK(!interruptor.triggered());
+
+        coro_t::migrate_home();
+        CHECK(thread_t::self() == home);
+        CHECK(interruptor.triggered());
+    }
+    setter.wait();
+
+    // A nested interruptor hears about its parent once we are back
+    event_t outer_event;
+    event_t inner_event;
+    coro_result_t<void> outer_setter = coro_t::spawn([&] { outer_event.set(); });
+    {
+        interruptor_t outer(&outer_event);
+        interruptor_t inner(&inner_event);
+        coro_t::migrate_to(other);
+        single_timer_t timer;
+        timer.start(10);
+        timer.wait();
+        CHECK(!inner.triggered());
+
+        coro_t::migrate_home();
+        CHECK(outer.triggered());
+        CHECK(inner.triggered());
+    }
+    outer_setter.wait();
+
+    // Results are fulfilled at home even if the coroutine is away when it returns
+    thread_t *finished_on = nullptr;
+    thread_t *resumed_on = coro_t::spawn([&] {
+            coro_t::migrate_to(other);
+            finished_on = thread_t::self();
+            return thread_t::self();
+        }).release();
+    CHECK(finished_on == away);
+    CHECK(resumed_on == away);
+    CHECK(thread_t::self() == home);
+    count += 1;
+}
+
+TEST_CASE("coro/migrate", "[coro][migrate]") {
+    coro_test_t::count = 0;
+    scheduler_t sched(2, shutdown_policy_t::Eager);
+    sched.broadcast_local<coro_test_t::migrate>();
+    sched.run();
+    CHECK(coro_test_t::count == 2u);
+}
+
+IMPL_STATIC_RPC(coro_test_t::stall)() -> void {
+    const uint64_t spin_ns = 200 * 1000 * 1000;
+    auto spin = [&] {
+        uint64_t start = cycle_clock_t::now();
+        while (cycle_clock_t::to_ns(cycle_clock_t::now() - start) < spin_ns) { }
+    };
+
+    // The watchdog may still be capturing when the spin ends
+    stall_state_t *state = thread_t::self()->stall_state();
+    auto wait_for_stalls = [&](uint64_t expected) {
+        for (size_t waited_ms = 0; state->stalls() < expected && waited_ms < 1000; ++waited_ms) {
+            single_timer_t timer(1);
+            timer.wait();
+        }
+        return state->stalls();
+    };
+
+    // Each stall is caught once, with the spawn site of the coroutine
+    uint64_t before = state->stalls();
+    coro_t::spawn(spin).wait();
+    CHECK(wait_for_stalls(before + 1) == before + 1);
+    stall_report_t report = state->last_report();
+    REQUIRE(report.spawn_site != nullptr);
+    CHECK(std::string(report.spawn_site) == spawn_site_name<decltype(spin)>());
+    CHECK(report.rpc_id == 0u);
+    CHECK(report.num_frames > 0u);
+    CHECK(report.stalled_ns < spin_ns);
+
+    // Or the RPC it is handling
+    spin();
+    CHECK(wait_for_stalls(before + 2) == before + 2);
+    report = state->last_report();
+    CHECK(report.rpc_id == coro_test_t::stall::s_rpc_id.value());
+    CHECK(report.num_frames > 0u);
+
+    // Stalls by coroutines run back to back in one long time slice are each caught
+    uint64_t old_latency = dispatcher_t::s_target_loop_latency_ns.exchange(4 * spin_ns);
+    auto first = coro_t::spawn(spin);
+    auto second = coro_t::spawn(spin);
+    first.wait();
+    second.wait();
+    dispatcher_t::s_target_loop_latency_ns.store(old_latency);
+    CHECK(wait_for_stalls(before + 4) == before + 4);
+}
+
+TEST_CASE("coro/stall", "[coro][stall]") {
+    uint64_t old_threshold = stall_watchdog_t::s_threshold_ns.exchange(20 * 1000 * 1000);
+    scheduler_t sched(1, shutdown_policy_t::Eager);
+    sched.broadcast_local<coro_test_t::stall>();
+    sched.run();
+    stall_watchdog_t::s_threshold_ns.store(old_threshold);
+}
+
+IMPL_STATIC_RPC(coro_test_t::check_affinity)() -> void {
+    const thread_topology_t &topology = thread_t::self()->target()->topology();
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    REQUIRE(pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0);
+    size_t num_cpus = CPU_COUNT(&cpus);
+    CHECK(num_cpus == topology.cpus.size());
+    for (int cpu : topology.cpus) {
+        CHECK(CPU_ISSET(cpu, &cpus));
+    }
+    count += 1;
+}
+
+TEST_CASE("coro/placement", "[coro][placement]") {
+    coro_test_t::count = 0;
+    thread_placement_t placement = thread_placement_t::pinned(num_threads);
+    scheduler_t sched(num_threads, 1, shutdown_policy_t::Eager, placement);
+
+    const std::vector<target_t *> &targets = sched.local_targets();
+    REQUIRE(targets.size() == num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        const thread_topology_t &topology = targets[i]->topology();
+        REQUIRE(topology.cpus.size() == 1u);
+        CHECK(topology.cpus[0] == placement.coro_cpus[i][0]);
+        CHECK(topology.numa_node == cpu_topology_t::instance()->node_of(topology.cpus[0]));
+    }
+    CHECK(sched.io_target()->topology().cpus == placement.io_cpus);
+
+    sched.broadcast_local<coro_test_t::check_affinity>();
+    sched.run();
+    CHECK(coro_test_t::count == num_threads);
+}
+
+TEST_CASE("coro/placement_disallowed", "[coro][placement]") {
+    // A CPU the process may not run on leaves the thread unpinned
+    thread_topology_t topology;
+    topology.cpus.push_back(CPU_SETSIZE - 1);
+    CHECK(!apply_thread_topology(topology));
+
+    thread_placement_t placement;
+    placement.coro_cpus.push_back(topology.cpus);
+    scheduler_t sched(1, 0, shutdown_policy_t::Eager, placement);
+    CHECK(sched.local_targets()[0]->topology().cpus == topology.cpus);
+    sched.run();
+}
+
+TEST_CASE("coro/busy_poll_budget", "[coro][busy_poll]") {
+    const uint64_t max_ns = 100 * 1000;
+    uint64_t old_max = busy_poll_t::s_max_spin_ns.exchange(max_ns);
+    busy_poll_t busy_poll;
+    CHECK(busy_poll.budget() == 0u);
+
+    // Grows while wakeups come soon after blocking, up to the max
+    busy_poll.note_block(0, cycle_clock_t::from_ns(10 * 1000));
+    uint64_t budget_ns = busy_poll.stats().budget_ns;
+    CHECK(budget_ns == busy_poll_t::s_min_spin_ns);
+    CHECK(busy_poll.budget() == cycle_clock_t::from_ns(budget_ns));
+    for (size_t i = 0; i < 10; ++i) {
+        busy_poll.note_block(0, cycle_clock_t::from_ns(max_ns / 2));
+    }
+    budget_ns = busy_poll.stats().budget_ns;
+    CHECK(budget_ns == max_ns);
+
+    // Hits leave the budget alone
+    busy_poll.note_hit(cycle_clock_t::from_ns(1000));
+    budget_ns = busy_poll.stats().budget_ns;
+    CHECK(budget_ns == max_ns);
+
+    // Shrinks to nothing while blocked for longer
+    busy_poll.note_block(cycle_clock_t::from_ns(max_ns), cycle_clock_t::from_ns(max_ns * 10));
+    budget_ns = busy_poll.stats().budget_ns;
+    CHECK(budget_ns == max_ns / 2);
+    for (size_t i = 0; i < 10; ++i) {
+        busy_poll.note_block(0, cycle_clock_t::from_ns(max_ns * 10));
+    }
+    CHECK(busy_poll.budget() == 0u);
+
+    busy_poll_t::stats_t stats = busy_poll.stats();
+    CHECK(stats.hits == 1u);
+    CHECK(stats.blocks == 22u);
+
+    // Lowering the max takes effect immediately
+    busy_poll.note_block(0, 0);
+    busy_poll_t::s_max_spin_ns.store(0);
+    CHECK(busy_poll.budget() == 0u);
+    busy_poll_t::s_max_spin_ns.store(old_max);
+}
+
+IMPL_STATIC_RPC(coro_test_t::echo)(uint64_t value) -> uint64_t {
+    return value;
+}
+
+IMPL_STATIC_RPC(coro_test_t::ping_peer)() -> void {
+    thread_t *self = thread_t::self();
+    target_t *other = nullptr;
+    for (target_t *t : self->hub()->local_targets()) {
+        if (t != self->target()) {
+            other = t;
+        }
+    }
+    REQUIRE(other != nullptr);
+
+    busy_poll_t::stats_t before = self->busy_poll()->stats();
+    const uint64_t num_pings = 200;
+    for (uint64_t i = 0; i < num_pings; ++i) {
+        uint64_t res = other->call_sync<coro_test_t::echo>(uint64_t(i));
+        CHECK(res == i);
+    }
+    busy_poll_t::stats_t after = self->busy_poll()->stats();
+
+    // Each idle period spins for at most the max
+    uint64_t idle_periods = (after.hits + after.blocks) - (before.hits + before.blocks);
+    uint64_t spin_ns = after.spin_ns - before.spin_ns;
+    CHECK(idle_periods > 0u);
+    CHECK(spin_ns <= idle_periods * busy_poll_t::s_max_spin_ns.load() + 1000 * 1000);
+    CHECK(after.budget_ns <= busy_poll_t::s_max_spin_ns.load());
+    count += 1;
+}
+
+TEST_CASE("coro/busy_poll", "[coro][busy_poll]") {
+    uint64_t old_max = busy_poll_t::s_max_spin_ns.exchange(200 * 1000);
+    coro_test_t::count = 0;
+    scheduler_t sched(2, shutdown_policy_t::Eager);
+    sched.broadcast_local<coro_test_t::ping_peer>();
+    sched.run();
+    CHECK(coro_test_t::count == 2u);
+    busy_poll_t::s_max_spin_ns.store(old_max);
+}
+
+IMPL_STATIC_RPC(coro_test_t::is_parked)() -> bool {
+    return thread_t::self()->parked();
+}
+
+IMPL_STATIC_RPC(coro_test_t::num_local_targets)() -> uint64_t {
+    return thread_t::self()->hub()->local_targets().size();
+}
+
+IMPL_STATIC_RPC(coro_test_t::resize_pool)() -> void {
+    thread_t *self = thread_t::self();
+    const std::vector<target_t *> &all = self->hub()->all_local_targets();
+    REQUIRE(all.size() == 4u);
+    count += 1;
+    if (self->target() != all[0]) {
+        return;
+    }
+
+    // The hub catches up with resizes before running anything
+    auto wait_for_pool = [&] (size_t num_active) {
+        while (self->hub()->local_targets().size() != num_active) {
+            coro_t::yield();
+        }
+    };
+    wait_for_pool(2);
+    CHECK(!self->parked());
+    CHECK(!all[1]->call_sync<coro_test_t::is_parked>());
+
+    // Parked threads still handle what is sent to them directly
+    CHECK(all[3]->call_sync<coro_test_t::is_parked>());
+
+    // Parked threads are woken up to join the pool
+    sched->resize(4);
+    wait_for_pool(4);
+    CHECK(!all[3]->call_sync<coro_test_t::is_parked>());
+    CHECK(all[3]->call_sync<coro_test_t::num_local_targets>() == 4u);
+    std::vector<bool> parked = self->hub()->broadcast_local_sync<coro_test_t::is_parked>();
+    CHECK(parked == std::vector<bool>(4, false));
+
+    // Work queued on a thread that gets parked is still finished
+    std::vector<future_t<void> > sleeps;
+    for (size_t i = 0; i < 10; ++i) {
+        sleeps.emplace_back(all[2]->call_async<coro_test_t::spin_then_sleep>(uint64_t(0), int64_t(5)));
+    }
+    sched->resize(2);
+    wait_for_pool(2);
+    wait_all(sleeps);
+    CHECK(all[2]->call_sync<coro_test_t::is_parked>());
+    parked = self->hub()->broadcast_local_sync<coro_test_t::is_parked>();
+    CHECK(parked == std::vector<bool>(2, false));
+}
+
+TEST_CASE("coro/resize", "[coro][resize]") {
+    coro_test_t::count = 0;
+    scheduler_t sched(4, shutdown_policy_t::Eager);
+    coro_test_t::sched = &sched;
+    CHECK(sched.local_targets().size() == 4u);
+
+    sched.resize(2);
+    CHECK(sched.num_active() == 2u);
+    CHECK(sched.broadcast_local<coro_test_t::resize_pool>() == 2u);
+    sched.run();
+    CHECK(coro_test_t::count == 2u);
+    coro_test_t::sched = nullptr;
+}
+
+IMPL_STATIC_RPC(coro_test_t::relay)(uint64_t hops) -> void {
+    if (hops == 0) {
+        count += 1;
+        return;
+    }
+
+    // Only the RPCs in flight keep the chains alive, shutdown must wait for them
+    // however they are spread over the threads' shards
+    const std::vector<target_t *> &targets = thread_t::self()->hub()->local_targets();
+    targets[hops % targets.size()]->call_noreply<coro_test_t::relay>(hops - 1);
+    if (hops % 2 == 0) {
+        coro_t::spawn_detached([] {
+                coro_t::yield();
+                thread_t::self()->target()->call_noreply<coro_test_t::relay>(uint64_t(0));
+            });
+    }
+}
+
+TEST_CASE("coro/shutdown_relay", "[coro][shutdown]") {
+    const uint64_t hops = 200;
+    coro_test_t::count = 0;
+    scheduler_t sched(num_threads, shutdown_policy_t::Eager);
+    for (size_t i = 0; i < 10; ++i) {
+        sched.broadcast_local<coro_test_t::relay>(uint64_t(hops));
+    }
+    sched.run();
+    CHECK(coro_test_t::count == 10 * num_threads * (1 + hops / 2));
+}
+
+TEST_CASE("coro/shutdown_stress", "[coro][shutdown]") {
+    // Every thread retires its last short task at about the same time, so
+    // their final flushes race with each other's scans
+    coro_test_t::count = 0;
+    scheduler_t sched(num_threads, shutdown_policy_t::Eager);
+    const size_t runs = 500;
+    for (size_t i = 0; i < runs; ++i) {
+        sched.broadcast_local<coro_test_t::relay>(uint64_t(1));
+        sched.run();
+    }
+    CHECK(coro_test_t::count == runs * num_threads);
+}
+
+IMPL_STATIC_RPC(coro_test_t::busy)(uint64_t spin_ns) -> void {
+    busy_started = true;
+    uint64_t start = cycle_clock_t::now();
+    while (cycle_clock_t::to_ns(cycle_clock_t::now() - start) < spin_ns) { }
+}
+
+IMPL_STATIC_RPC(coro_test_t::call_any)() -> void {
+    thread_t *self = thread_t::self();
+    const std::vector<target_t *> &targets = self->hub()->local_targets();
+    REQUIRE(targets.size() == 2u);
+    target_t *other = (targets[0] == self->target()) ? targets[1] : targets[0];
+
+    // Keep the other thread from reading its queue
+    busy_started = false;
+    other->call_noreply<coro_test_t::busy>(uint64_t(300 * 1000 * 1000));
+    while (!busy_started) {
+        coro_t::yield();
+    }
+    for (uint64_t i = 0; i < 10; ++i) {
+        other->call_noreply<coro_test_t::busy>(uint64_t(20 * 1000 * 1000));
+    }
+
+    // The depth is published once the other thread has drained its queue
+    stream_load_t load = other->load();
+    for (size_t waited_ms = 0; load.queued < 10u && waited_ms < 1000; ++waited_ms) {
+        single_timer_t timer(1);
+        timer.wait();
+        load = other->load();
+    }
+    CHECK(load.queued >= 10u);
+
+    // With two threads, both are always candidates
+    for (size_t i = 0; i < 20; ++i) {
+        CHECK(self->hub()->pick_target() == self->target());
+    }
+    CHECK(self->hub()->call_any_sync<coro_test_t::echo>(uint64_t(7)) == 7u);
+    future_t<uint64_t> res = self->hub()->call_any_async<coro_test_t::echo>(uint64_t(8));
+    CHECK(res.get() == 8u);
+    count += 1;
+}
+
+TEST_CASE("coro/call_any", "[coro][call_any]") {
+    coro_test_t::count = 0;
+    scheduler_t sched(2, shutdown_policy_t::Eager);
+    sched.local_targets()[0]->call_noreply<coro_test_t::call_any>();
+    sched.run();
+    CHECK(coro_test_t::count == 1u);
+}
+
+TEST_CASE("coro/rpc_priority", "[coro][priority]") {
+    coro_test_t::count = 0;
+    scheduler_t sched(num_threads, shutdown_policy_t::Eager);
+    sched.broadcast_local<coro_test_t::high_priority>();
+    sched.run();
+    CHECK(coro_test_t::count == num_threads);
+}
@@ -0,0 +1,113 @@
+#include "test.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "containers/file.hpp"
+#include "coro/events.hpp"
+#include "coro/thread.hpp"
+#include "sync/event.hpp"
+#include "sync/file_wait.hpp"
+#include "sync/multiple_wait.hpp"
+#include "sync/timer.hpp"
+#include "utils.hpp"
+
+using namespace indecorous;
+
+// Sends bytes one at a time over a pipe, the reader waits whenever it is empty
+void pipe_exchange(int read_fd, int write_fd, size_t count) {
+    file_wait_t in = file_wait_t::in(read_fd);
+    auto writer = coro_t::spawn([&] {
+            for (size_t i = 0; i < count; ++i) {
+                char c = static_cast<char>(i);
+                GUARANTEE_ERR(::write(write_fd, &c, 1) == 1);
+                coro_t::yield();
+            }
+        });
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; ++i) {
+        char c;
+        ssize_t res = eintr_wrap([&] { return ::read(read_fd, &c, 1); }, &in);
+        if (res != 1 || c != static_cast<char>(i)) {
+            ++mismatches;
+        }
+    }
+    writer.wait();
+    CHECK(mismatches == 0u);
+}
+
+SIMPLE_TEST(file_wait, registered, 1, "[sync][file_wait]") {
+    int fds[2];
+    REQUIRE(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0);
+    scoped_fd_t read_end(fds[0]);
+    scoped_fd_t write_end(fds[1]);
+    events_t *events = thread_t::self()->events();
+    const size_t count = 100;
+
+    uint64_t before = events->epoll_ctl_calls();
+    pipe_exchange(read_end.get(), write_end.get(), count);
+    uint64_t level_calls = events->epoll_ctl_calls() - before;
+    CHECK(level_calls > 0u);
+
+    file_registration_t registration(read_end.get());
+    before = events->epoll_ctl_calls();
+    pipe_exchange(read_end.get(), write_end.get(), count);
+    uint64_t edge_calls = events->epoll_ctl_calls() - before;
+    CHECK(edge_calls == 0u);
+
+    // An edge seen while nobody was waiting satisfies the next wait
+    char c = 0;
+    GUARANTEE_ERR(::write(write_end.get(), &c, 1) == 1);
+    events->check(false);
+
+    absolute_time_t start(0);
+    file_wait_t in = file_wait_t::in(read_end.get());
+    single_timer_t timeout(5000);
+    wait_any(in, timeout);
+    int64_t waited_ms = absolute_time_t::ms_diff(absolute_time_t(0), start);
+    CHECK(waited_ms < 5000);
+    CHECK(::read(read_end.get(), &c, 1) == 1);
+}
+
+SIMPLE_TEST(file_wait, high_fd, 1, "[sync][file_wait]") {
+    int fds[2];
+    REQUIRE(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0);
+    scoped_fd_t read_end(fds[0]);
+    scoped_fd_t write_end(fds[1]);
+    scoped_fd_t high_read_end(::fcntl(read_end.get(), F_DUPFD_CLOEXEC, 1000));
+    REQUIRE(high_read_end.valid());
+
+    // The events table grows while there is a wait on a lower fd
+    event_t waiting;
+    auto waiter = coro_t::spawn([&] {
+            file_wait_t in = file_wait_t::in(read_end.get());
+            waiting.set();
+            in.wait();
+        });
+    waiting.wait();
+    file_registration_t registration(high_read_end.get());
+
+    pipe_exchange(high_read_end.get(), write_end.get(), 10);
+    char c = 0;
+    GUARANTEE_ERR(::write(write_end.get(), &c, 1) == 1);
+    waiter.wait();
+    CHECK(::read(read_end.get(), &c, 1) == 1);
+}
+
+SIMPLE_TEST(file_wait, reused_fd, 1, "[sync][file_wait]") {
+    // A registration is dropped and its fd closed and reused before the
+    // event loop gets to remove it from the epoll set
+    int reused_fd = -1;
+    for (size_t i = 0; i < 3; ++i) {
+        int fds[2];
+        REQUIRE(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0);
+        scoped_fd_t read_end(fds[0]);
+        scoped_fd_t write_end(fds[1]);
+        CHECK((reused_fd == -1 || reused_fd == read_end.get()));
+        reused_fd = read_end.get();
+
+        file_registration_t registration(read_end.get());
+        pipe_exchange(read_end.get(), write_end.get(), 10);
+    }
+}
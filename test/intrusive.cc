@@ -46,6 +46,32 @@ TEST_CASE("intrusive/push_back", "[container][intrusive]") {
     CHECK(!c.in_a_list());
 }
 
+TEST_CASE("intrusive/splice_back", "[container][intrusive]") {
+    test_object_t a, b, c;
+    intrusive_list_t<test_object_t> list;
+    intrusive_list_t<test_object_t> other;
+
+    list.splice_back(&other);
+    CHECK(list.size() == 0);
+
+    list.push_back(&a);
+    other.push_back(&b);
+    other.push_back(&c);
+    list.splice_back(&other);
+    CHECK(list.size() == 3);
+    CHECK(other.size() == 0);
+    CHECK(list.front() == &a);
+    CHECK(list.next(&a) == &b);
+    CHECK(list.back() == &c);
+
+    other.splice_back(&list);
+    CHECK(list.size() == 0);
+    CHECK(other.size() == 3);
+    CHECK(other.back() == &c);
+
+    other.clear([] (test_object_t *) {});
+}
+
 TEST_CASE("intrusive/move-1", "[container][intrusive][]") {
     test_object_t object;
     intrusive_list_t<test_object_t> list;
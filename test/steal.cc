@@ -0,0 +1,95 @@
+#include <atomic>
+#include <chrono>
+
+#include "test.hpp"
+
+#include "coro/sched.hpp"
+#include "coro/thread.hpp"
+#include "rpc/handler.hpp"
+#include "rpc/hub.hpp"
+#include "rpc/target.hpp"
+
+using namespace indecorous;
+
+const size_t steal_threads = 4;
+const size_t steal_tasks = 64;
+
+struct steal_test_t {
+    static std::atomic<size_t> run_count;
+    static std::atomic<size_t> stolen_count;
+
+    static bool on_first_thread() {
+        thread_t *self = thread_t::self();
+        return self->target() == self->hub()->local_targets()[0];
+    }
+
+    static void note_run() {
+        if (!on_first_thread()) {
+            ++stolen_count;
+        }
+        ++run_count;
+    }
+
+    DECLARE_STATIC_RPC(pinned)() -> void;
+    DECLARE_STEALABLE_STATIC_RPC(stealable)() -> void;
+    DECLARE_STATIC_RPC(skewed_pinned)() -> void;
+    DECLARE_STATIC_RPC(skewed_stealable)() -> void;
+};
+
+std::atomic<size_t> steal_test_t::run_count(0);
+std::atomic<size_t> steal_test_t::stolen_count(0);
+
+IMPL_STATIC_RPC(steal_test_t::pinned)() -> void {
+    note_run();
+}
+
+IMPL_STATIC_RPC(steal_test_t::stealable)() -> void {
+    note_run();
+}
+
+// Queues tasks on the first thread then hogs it, so the tasks can only be run
+// elsewhere until it gives up
+template <typename RPC>
+void send_skewed(std::chrono::seconds timeout) {
+    if (!steal_test_t::on_first_thread()) {
+        return;
+    }
+
+    target_t *self = thread_t::self()->target();
+    for (size_t i = 0; i < steal_tasks; ++i) {
+        self->call_noreply<RPC>();
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (steal_test_t::run_count.load() < steal_tasks &&
+           std::chrono::steady_clock::now() < deadline) { }
+}
+
+IMPL_STATIC_RPC(steal_test_t::skewed_pinned)() -> void {
+    send_skewed<steal_test_t::pinned>(std::chrono::seconds(0));
+}
+
+IMPL_STATIC_RPC(steal_test_t::skewed_stealable)() -> void {
+    send_skewed<steal_test_t::stealable>(std::chrono::seconds(10));
+}
+
+template <typename RPC>
+void run_skewed() {
+    steal_test_t::run_count = 0;
+    steal_test_t::stolen_count = 0;
+    scheduler_t sched(steal_threads, shutdown_policy_t::Eager);
+    sched.broadcast_local<RPC>();
+    sched.run();
+}
+
+TEST_CASE("steal/stealable", "[steal]") {
+    run_skewed<steal_test_t::skewed_stealable>();
+    CHECK(steal_test_t::run_count.load() == steal_tasks);
+    CHECK(steal_test_t::stolen_count.load() == steal_tasks);
+}
+
+TEST_CASE("steal/pinned", "[steal]") {
+    run_skewed<steal_test_t::skewed_pinned>();
+    CHECK(steal_test_t::run_count.load() == steal_tasks);
+    CHECK(steal_test_t::stolen_count.load() == 0);
+}
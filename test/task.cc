@@ -0,0 +1,106 @@
+#include "test.hpp"
+
+#include "coro/task.hpp"
+
+#if INDECOROUS_TASKS
+
+#include "coro/coro.hpp"
+#include "coro/thread.hpp"
+#include "errors.hpp"
+#include "sync/event.hpp"
+#include "sync/semaphore.hpp"
+#include "sync/timer.hpp"
+
+using namespace indecorous;
+
+task_t<int> add_after(event_t *event, int a, int b) {
+    co_await *event;
+    co_return a + b;
+}
+
+task_t<int> sleep_then_add(int64_t ms, int a, int b) {
+    co_await single_timer_t(ms);
+    event_t event;
+    event.set();
+    int res = co_await add_after(&event, a, b);
+    // Through a future_t as well
+    co_return co_await spawn_task(add_after(&event, res, 0));
+}
+
+task_t<void> wait_lost(bool *lost) {
+    event_t *event = new event_t();
+    spawn_task_detached([] (event_t *e) -> task_t<void> {
+            delete e;
+            co_return;
+        }(event));
+    try {
+        co_await *event;
+    } catch (const wait_object_lost_exc_t &) {
+        *lost = true;
+    }
+}
+
+SIMPLE_TEST(task, basic, 1, "[coro][task]") {
+    event_t event;
+    future_t<int> sum = spawn_task(add_after(&event, 1, 2));
+    coro_t::yield();
+    CHECK(!sum.has());
+    event.set();
+    CHECK(sum.get() == 3);
+
+    // Tasks awaiting tasks and timers
+    CHECK(spawn_task(sleep_then_add(5, 3, 4)).get() == 7);
+
+    // Failed waits throw in the task
+    bool lost = false;
+    spawn_task(wait_lost(&lost)).wait();
+    CHECK(lost);
+}
+
+task_t<void> take_one(semaphore_t *sem, future_t<int> *value, int *out) {
+    semaphore_acq_t acq = sem->start_acq(1);
+    co_await acq;
+    *out = co_await *value;
+}
+
+SIMPLE_TEST(task, with_coroutines, 1, "[coro][task]") {
+    // Tasks and coroutines waiting on each other
+    semaphore_t sem(0);
+    event_t go;
+    auto value = coro_t::spawn([&] { go.wait(); return 5; });
+    int out = 0;
+    future_t<void> done = spawn_task(take_one(&sem, &value, &out));
+    coro_t::yield();
+    sem.extend(1);
+    go.set();
+    done.wait();
+    CHECK(out == 5);
+}
+
+SIMPLE_TEST(task, fanout, 1, "[coro][task]") {
+    // No coroutines are needed for the tasks
+    size_t extant = thread_t::self()->dispatcher()->m_coro_cache.extant();
+
+    const size_t num_tasks = 10000;
+    event_t start;
+    event_t all_done;
+    size_t finished = 0;
+    for (size_t i = 0; i < num_tasks; ++i) {
+        spawn_task_detached([] (event_t *s, event_t *d, size_t *f, size_t n) -> task_t<void> {
+                co_await *s;
+                if (++*f == n) {
+                    d->set();
+                }
+            }(&start, &all_done, &finished, num_tasks));
+    }
+    coro_t::yield();
+    CHECK(finished == 0);
+    // Other coroutines may finish meanwhile, but none are started
+    CHECK(thread_t::self()->dispatcher()->m_coro_cache.extant() <= extant);
+
+    start.set();
+    all_done.wait();
+    CHECK(finished == num_tasks);
+}
+
+#endif // INDECOROUS_TASKS
@@ -0,0 +1,114 @@
+#include "test.hpp"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "coro/timer_wheel.hpp"
+#include "sync/timer.hpp"
+
+using namespace indecorous;
+
+class test_timer_t final : public timer_callback_t {
+public:
+    explicit test_timer_t(int64_t delta_ms) : fired(false) {
+        m_timeout = absolute_time_t(delta_ms);
+    }
+
+    void timer_callback(wait_result_t) override final {
+        fired = true;
+    }
+
+    bool fired;
+};
+
+TEST_CASE("timer/wheel", "[sync][timer]") {
+    timer_wheel_t wheel;
+    uint64_t start_ms = timer_wheel_t::now_ms();
+
+    // Every level, the edges between them, and past the top
+    std::vector<int64_t> deltas = { -5, 0, 1, 2, 63, 64, 65, 4095, 4096, 4097, 300000,
+                                    (int64_t(1) << 24) + 5, (int64_t(1) << 30) + 7 };
+    std::mt19937 gen(1234);
+    for (size_t i = 0; i < 2000; ++i) {
+        deltas.push_back(std::uniform_int_distribution<int64_t>(0, int64_t(1) << (i % 32))(gen));
+    }
+
+    std::vector<std::unique_ptr<test_timer_t> > timers;
+    for (int64_t delta : deltas) {
+        timers.emplace_back(new test_timer_t(delta));
+        wheel.add(timers.back().get());
+    }
+    CHECK(wheel.size() == deltas.size());
+
+    // Some timers are stopped before they fire
+    for (size_t i = 20; i < timers.size(); i += 7) {
+        wheel.remove(timers[i].get());
+    }
+
+    uint64_t end_ms = start_ms + (uint64_t(1) << 31);
+    for (uint64_t now = start_ms; now < end_ms; now += 1 + (now - start_ms) / 3) {
+        // The next timeout never skips past a due timer
+        int64_t timeout = wheel.next_timeout_ms(now);
+        wheel.advance(now);
+
+        size_t early = 0;
+        while (timer_callback_t *cb = wheel.pop_expired()) {
+            if (cb->timeout().ms_rounded_up() > now) {
+                ++early;
+            }
+            cb->timer_callback(wait_result_t::Success);
+        }
+        CHECK(early == 0u);
+
+        size_t late = 0;
+        size_t due = 0;
+        for (size_t i = 0; i < timers.size(); ++i) {
+            bool removed = (i >= 20 && (i - 20) % 7 == 0);
+            uint64_t expiry = timers[i]->timeout().ms_rounded_up();
+            if (!removed && !timers[i]->fired && expiry <= now) {
+                ++late;
+            }
+            if (!removed && !timers[i]->fired && (timeout == -1 || expiry < now + timeout)) {
+                ++due;
+            }
+        }
+        CHECK(late == 0u);
+        CHECK(due == 0u);
+    }
+
+    wheel.advance(end_ms + (uint64_t(1) << 32));
+    while (timer_callback_t *cb = wheel.pop_expired()) {
+        cb->timer_callback(wait_result_t::Success);
+    }
+
+    for (size_t i = 0; i < timers.size(); ++i) {
+        bool removed = (i >= 20 && (i - 20) % 7 == 0);
+        CHECK(timers[i]->fired != removed);
+    }
+    CHECK(wheel.size() == 0u);
+}
+
+SIMPLE_TEST(timer, single, 1, "[sync][timer]") {
+    // Timers never fire early, whatever order they were started in
+    std::vector<coro_result_t<void> > waits;
+    for (int64_t i = 0; i < 100; ++i) {
+        int64_t timeout_ms = (i * 7) % 30;
+        waits.emplace_back(coro_t::spawn([timeout_ms] {
+                absolute_time_t deadline(timeout_ms);
+                single_timer_t timer(timeout_ms);
+                timer.wait();
+                CHECK(!(absolute_time_t(0) < deadline));
+            }));
+    }
+    wait_all(waits);
+
+    // Restarting or stopping a timer takes it out of its old slot
+    single_timer_t timer(60 * 1000);
+    timer.start(1);
+    timer.wait();
+    timer.start(60 * 1000);
+    timer.stop();
+    timer.start(2);
+    timer.wait();
+}